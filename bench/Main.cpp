@@ -0,0 +1,570 @@
+import CPU;
+import Emulator;
+import Lanes;
+import Movie;
+import NES;
+import PPU;
+import Profiler;
+import Rewind;
+import Snapshot;
+import System;
+
+import NumericalTypes;
+
+import <algorithm>;
+import <array>;
+import <chrono>;
+import <cstdlib>;
+import <filesystem>;
+import <format>;
+import <future>;
+import <iostream>;
+import <memory>;
+import <span>;
+import <string>;
+import <vector>;
+
+/* Headless benchmark runner. Runs a rom for a fixed number of frames without video, audio or input,
+   and reports emulated cpu cycles and frames per second of host time, together with the host time spent in each component.
+   If more than one instance is requested, that many independent Emulator instances run the rom in parallel, and the
+   aggregate throughput is reported.
+   With --dispatch, the rom is instead run from power-on once with each cpu dispatch core, and the instructions executed per
+   second of host time are reported for each.
+   With --core-diff, the rom is run by two instances in lockstep, one with the block cache core, which executes pre-decoded
+   code, and one with the function table interpreter. After every call to CPU::Run, their registers, cycle and instruction counts and a hash of all bus accesses
+   are compared, and the first divergence is reported.
+   With --opcodes, every opcode (except the JAM opcodes) is instead executed on its own many times in a row (see
+   CPU::ExecuteOpcode), and the host time per instruction is reported in a table indexed by opcode. This includes the time
+   of stepping the other components for the cycles of the instruction, unless NES_PROFILE_SUBSYSTEMS is defined, in which case
+   the (sampled) APU and PPU time is subtracted. Compare builds with and without NES_CPU_LAZY_FLAGS to see the effect of lazy
+   status flags.
+   With --profile, the rom is run with the cycle profiler attached (see Profiler), and the flat profile and the collapsed
+   call stacks are written to profile.txt and profile.folded in the working directory.
+   With --run-ahead, the rom is run with NES::RunFrameAhead, and the host time per presented frame is reported, together with
+   the size of a snapshot and the time it takes to save and load one.
+   With --rewind, the rom is run with a state captured into a Rewind::Buffer every given number of frames, and the host time
+   spent capturing per frame and the memory the compressed states take per minute of emulated time are reported, together
+   with the time it takes to step back through them.
+   With --movie, an input movie of the rom is recorded with pseudo-random input, written to movie.nesmovie in the working
+   directory and loaded back, and the host time it takes to seek to random frames of it is reported. Seeking to the end is
+   checked to give the same picture as the recording.
+   With --lanes, a Lanes::Batch of the given number of lanes is stepped with pseudo-random input per lane, and the frames per
+   second of host time over all lanes are reported. Lanes 0 and 1 get the same input, and their RAM is checked to be equal.
+   Usage: NESBench <rom path> [number of frames] [number of instances]
+          NESBench --dispatch <rom path> [number of frames]
+          NESBench --core-diff <rom path> [number of frames]
+          NESBench --opcodes <rom path> [number of executions per opcode]
+          NESBench --profile <rom path> [number of frames]
+          NESBench --run-ahead <rom path> [number of frames] [number of frames to run ahead]
+          NESBench --rewind <rom path> [number of frames] [number of frames between captures]
+          NESBench --movie <rom path> [number of frames] [number of frames between keyframes]
+          NESBench --lanes <rom path> [number of frames] [number of lanes] */
+
+template<CPU::DispatchCore core>
+void RunDispatchCore(const char* name, uint num_frames)
+{
+	NES::Initialize();
+	const u64 start_instructions = CPU::GetInstructionCount();
+	const u64 start_frames = PPU::GetFrameCount();
+	const auto start_time = std::chrono::steady_clock::now();
+	while (PPU::GetFrameCount() - start_frames < num_frames) {
+		CPU::Run<core>();
+	}
+	const auto end_time = std::chrono::steady_clock::now();
+
+	const u64 instructions = CPU::GetInstructionCount() - start_instructions;
+	const f64 total_sec = std::chrono::duration<f64>(end_time - start_time).count();
+	std::cout << std::format("{:<16}{:.3f} s, {} instructions, {:.0f} instructions/sec\n",
+		name, total_sec, instructions, instructions / total_sec);
+}
+
+
+int CompareDispatchCores(const std::string& rom_path, uint num_frames)
+{
+	if (!NES::LoadRom(rom_path)) {
+		return EXIT_FAILURE;
+	}
+	std::cout << std::format("Rom:           {}\n", rom_path);
+	std::cout << std::format("Frames:        {}\n", num_frames);
+	RunDispatchCore<CPU::DispatchCore::FunctionTable>("Function table:", num_frames);
+	RunDispatchCore<CPU::DispatchCore::Switch>("Switch:", num_frames);
+	RunDispatchCore<CPU::DispatchCore::BlockCache>("Block cache:", num_frames);
+	return EXIT_SUCCESS;
+}
+
+
+int CompareBlockCacheWithInterpreter(const std::string& rom_path, uint num_frames)
+{
+	Emulator block_cache, interpreter;
+	if (!block_cache.LoadRom(rom_path) || !interpreter.LoadRom(rom_path)) {
+		return EXIT_FAILURE;
+	}
+	block_cache.Execute([] { CPU::EnableBusTrace(true); }).wait();
+	interpreter.Execute([] { CPU::EnableBusTrace(true); }).wait();
+
+	auto print_state = [](const char* name, const CPU::TraceState& state) {
+		std::cout << std::format("{:<13}PC:{:04X} A:{:02X} X:{:02X} Y:{:02X} P:{:02X} SP:{:02X} CYC:{} INSTR:{} BUS:{:016X}\n",
+			name, state.pc, state.a, state.x, state.y, state.p, state.sp, state.cycles, state.instructions, state.bus_hash);
+	};
+
+	std::cout << std::format("Rom:           {}\n", rom_path);
+	u64 num_runs = 0;
+	while (block_cache.GetFrameCount() < num_frames) {
+		auto block_cache_run = block_cache.Execute([] { CPU::Run<CPU::DispatchCore::BlockCache>(); return CPU::GetTraceState(); });
+		auto interpreter_run = interpreter.Execute([] { CPU::Run<CPU::DispatchCore::FunctionTable>(); return CPU::GetTraceState(); });
+		const CPU::TraceState block_cache_state = block_cache_run.get();
+		const CPU::TraceState interpreter_state = interpreter_run.get();
+		++num_runs;
+		if (block_cache_state != interpreter_state) {
+			std::cout << std::format("Divergence in call {} to CPU::Run (frame {}):\n", num_runs, interpreter.GetFrameCount());
+			print_state("Block cache:", block_cache_state);
+			print_state("Interpreter:", interpreter_state);
+			return EXIT_FAILURE;
+		}
+	}
+	if (block_cache.GetFramebuffer() != interpreter.GetFramebuffer()) {
+		std::cout << "The cpu traces match, but the pictures differ.\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << std::format("No divergence in {} frames ({} calls to CPU::Run).\n", block_cache.GetFrameCount(), num_runs);
+	return EXIT_SUCCESS;
+}
+
+
+int BenchmarkOpcodes(const std::string& rom_path, uint num_executions)
+{
+	if (!NES::LoadRom(rom_path)) {
+		return EXIT_FAILURE;
+	}
+	NES::Initialize();
+	System::ResetHostTimers();
+	std::cout << std::format("Rom:           {}\n", rom_path);
+	std::cout << std::format("Lazy flags:    {}\n", CPU::lazy_flags ? "yes" : "no");
+	std::cout << std::format("{} time per instruction (ns), by opcode:\n", System::profile_subsystems ? "CPU" : "Host");
+	std::cout << "    ";
+	for (uint column = 0; column < 16; ++column) {
+		std::cout << std::format("{:>6X}", column);
+	}
+	std::cout << '\n';
+
+	f64 total_ns = 0;
+	uint num_opcodes = 0;
+	for (uint row = 0; row < 16; ++row) {
+		std::cout << std::format("{:X}_  ", row);
+		for (uint column = 0; column < 16; ++column) {
+			const u8 opcode = u8(row << 4 | column);
+			/* The JAM opcodes ($x2, except for $82, $A2, $C2 and $E2) halt the cpu. */
+			if (column == 2 && (row < 8 || row % 2 == 1)) {
+				std::cout << std::format("{:>6}", "-");
+				continue;
+			}
+			const u64 start_component_ns = System::GetApuHostTimeNs() + System::GetPpuHostTimeNs();
+			const auto start_time = std::chrono::steady_clock::now();
+			for (uint i = 0; i < num_executions; ++i) {
+				CPU::ExecuteOpcode(opcode);
+			}
+			const auto end_time = std::chrono::steady_clock::now();
+			f64 ns = std::chrono::duration<f64, std::nano>(end_time - start_time).count();
+			if constexpr (System::profile_subsystems) {
+				ns -= f64(System::GetApuHostTimeNs() + System::GetPpuHostTimeNs() - start_component_ns);
+			}
+			ns /= num_executions;
+			std::cout << std::format("{:>6.1f}", ns);
+			total_ns += ns;
+			++num_opcodes;
+		}
+		std::cout << '\n';
+	}
+	std::cout << std::format("Mean:          {:.2f} ns\n", total_ns / num_opcodes);
+	return EXIT_SUCCESS;
+}
+
+
+int ProfileRom(const std::string& rom_path, uint num_frames)
+{
+	if (!NES::LoadRom(rom_path)) {
+		return EXIT_FAILURE;
+	}
+	NES::Initialize();
+	Profiler::Start();
+	for (uint i = 0; i < num_frames; ++i) {
+		NES::RunFrame();
+	}
+	Profiler::Stop();
+	if (!Profiler::WriteFlatProfile("profile.txt") || !Profiler::WriteCollapsedStacks("profile.folded")) {
+		std::cerr << "Failed to write the profile." << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << std::format("Profiled {} frames of {}; wrote profile.txt and profile.folded.\n", num_frames, rom_path);
+	return EXIT_SUCCESS;
+}
+
+
+int BenchmarkRunAhead(const std::string& rom_path, uint num_frames, uint num_frames_ahead)
+{
+	if (!NES::LoadRom(rom_path)) {
+		return EXIT_FAILURE;
+	}
+	NES::Initialize();
+
+	using Duration = std::chrono::duration<f64, std::milli>;
+	Duration total_time{}, max_time{};
+	for (uint i = 0; i < num_frames; ++i) {
+		const auto start_time = std::chrono::steady_clock::now();
+		NES::RunFrameAhead(num_frames_ahead);
+		const Duration time = std::chrono::steady_clock::now() - start_time;
+		total_time += time;
+		max_time = std::max(max_time, time);
+	}
+
+	constexpr uint num_snapshots = 10000;
+	Snapshot snapshot;
+	NES::SaveSnapshot(snapshot);
+	const auto save_start_time = std::chrono::steady_clock::now();
+	for (uint i = 0; i < num_snapshots; ++i) {
+		NES::SaveSnapshot(snapshot);
+	}
+	const auto load_start_time = std::chrono::steady_clock::now();
+	for (uint i = 0; i < num_snapshots; ++i) {
+		NES::LoadSnapshot(snapshot);
+	}
+	const auto end_time = std::chrono::steady_clock::now();
+	const f64 save_us = std::chrono::duration<f64, std::micro>(load_start_time - save_start_time).count() / num_snapshots;
+	const f64 load_us = std::chrono::duration<f64, std::micro>(end_time - load_start_time).count() / num_snapshots;
+	const f64 frame_budget_ms = 1000.0 * System::standard.num_scanlines * 341 / System::standard.ppu_dots_per_cpu_cycle
+		/ System::standard.cpu_cycles_per_sec;
+
+	std::cout << std::format("Rom:           {}\n", rom_path);
+	std::cout << std::format("Frames:        {} ({} ahead)\n", num_frames, num_frames_ahead);
+	std::cout << std::format("Frame time:    {:.3f} ms average, {:.3f} ms max ({:.1f}% of the {:.2f} ms frame budget)\n",
+		total_time.count() / num_frames, max_time.count(), 100.0 * max_time.count() / frame_budget_ms, frame_budget_ms);
+	std::cout << std::format("Snapshot:      {} bytes, saved in {:.2f} us, loaded in {:.2f} us\n",
+		snapshot.GetData().size(), save_us, load_us);
+	return EXIT_SUCCESS;
+}
+
+
+int BenchmarkRewind(const std::string& rom_path, uint num_frames, uint frame_interval)
+{
+	if (!NES::LoadRom(rom_path)) {
+		return EXIT_FAILURE;
+	}
+	NES::Initialize();
+
+	/* Large enough that no state is dropped, so that the memory per minute is that of the whole run. */
+	Rewind::Buffer rewind{ size_t(1) << 30, frame_interval };
+	using Duration = std::chrono::duration<f64, std::micro>;
+	Duration total_time{}, max_time{};
+	for (uint i = 0; i < num_frames; ++i) {
+		NES::RunFrame();
+		const auto start_time = std::chrono::steady_clock::now();
+		rewind.Capture();
+		const Duration time = std::chrono::steady_clock::now() - start_time;
+		total_time += time;
+		max_time = std::max(max_time, time);
+	}
+	const size_t num_states = rewind.GetNumStates();
+	const size_t memory_usage = rewind.GetMemoryUsage();
+
+	const auto step_back_start_time = std::chrono::steady_clock::now();
+	while (rewind.StepBack() && rewind.GetNumStates() > 1) {
+	}
+	const Duration step_back_time = std::chrono::steady_clock::now() - step_back_start_time;
+	const f64 frames_per_minute = 60.0 * System::standard.cpu_cycles_per_sec * System::standard.ppu_dots_per_cpu_cycle
+		/ (System::standard.num_scanlines * 341);
+
+	std::cout << std::format("Rom:           {}\n", rom_path);
+	std::cout << std::format("Frames:        {} (captured every {})\n", num_frames, frame_interval);
+	std::cout << std::format("Capture time:  {:.2f} us per frame on average, {:.2f} us max\n",
+		total_time.count() / num_frames, max_time.count());
+	std::cout << std::format("States:        {}, {} bytes ({:.1f} bytes per state)\n",
+		num_states, memory_usage, f64(memory_usage) / num_states);
+	std::cout << std::format("Memory/minute: {:.1f} KiB\n", memory_usage / 1024.0 * frames_per_minute / num_frames);
+	std::cout << std::format("Step back:     {:.2f} us per state\n", step_back_time.count() / num_states);
+	return EXIT_SUCCESS;
+}
+
+
+int BenchmarkMovie(const std::string& rom_path, uint num_frames, uint keyframe_interval)
+{
+	if (!NES::LoadRom(rom_path)) {
+		return EXIT_FAILURE;
+	}
+	NES::Initialize();
+
+	/* A button is pressed or released every few frames, as picked by a linear congruential generator. */
+	u32 random = 1;
+	auto next_random = [&random] {
+		random = random * 1664525 + 1013904223;
+		return random >> 16;
+	};
+	std::array<bool, 8> held{};
+	const auto record_start_time = std::chrono::steady_clock::now();
+	Movie::StartRecording(keyframe_interval);
+	for (uint i = 0; i < num_frames; ++i) {
+		if (next_random() % 8 == 0) {
+			const uint button = next_random() % 8;
+			held[button] = !held[button];
+			if (held[button]) {
+				NES::NotifyButtonPressed(0, button);
+			}
+			else {
+				NES::NotifyButtonReleased(0, button);
+			}
+		}
+		NES::RunFrame();
+		Movie::OnFrame();
+	}
+	Movie::Stop();
+	const std::chrono::duration<f64> record_time = std::chrono::steady_clock::now() - record_start_time;
+	const std::vector<u8> last_picture = PPU::GetFramebuffer();
+	const std::string movie_path = "movie.nesmovie";
+	if (!Movie::Save(movie_path) || !Movie::Load(movie_path) || !Movie::StartPlayback()) {
+		std::cerr << "Could not save and load back the movie." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	using Duration = std::chrono::duration<f64, std::milli>;
+	Duration total_time{}, max_time{};
+	constexpr uint num_seeks = 100;
+	for (uint i = 0; i <= num_seeks; ++i) {
+		/* The last seek is to the end. */
+		const u64 frame = i < num_seeks ? next_random() * u64(next_random()) % (num_frames + 1) : num_frames;
+		const auto start_time = std::chrono::steady_clock::now();
+		Movie::Seek(frame);
+		const Duration time = std::chrono::steady_clock::now() - start_time;
+		total_time += time;
+		max_time = std::max(max_time, time);
+	}
+	const bool picture_matches = PPU::GetFramebuffer() == last_picture;
+
+	std::cout << std::format("Rom:           {}\n", rom_path);
+	std::cout << std::format("Frames:        {} (a keyframe every {})\n", num_frames, keyframe_interval);
+	std::cout << std::format("Recording:     {:.3f} s\n", record_time.count());
+	std::cout << std::format("Movie size:    {} bytes\n", std::filesystem::file_size(movie_path));
+	std::cout << std::format("Seek time:     {:.3f} ms average, {:.3f} ms max\n",
+		total_time.count() / (num_seeks + 1), max_time.count());
+	std::cout << std::format("Playback:      the picture at the end {} that of the recording\n",
+		picture_matches ? "matches" : "DIFFERS from");
+	return picture_matches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+int BenchmarkLanes(const std::string& rom_path, uint num_frames, uint num_lanes)
+{
+	Lanes::Batch batch{ num_lanes };
+	if (!batch.LoadRom(rom_path)) {
+		return EXIT_FAILURE;
+	}
+
+	/* Every lane toggles a random button every few frames, as picked by a linear congruential generator. */
+	u32 random = 1;
+	auto next_random = [&random] {
+		random = random * 1664525 + 1013904223;
+		return random >> 16;
+	};
+	std::vector<Lanes::Input> inputs(num_lanes);
+	const auto start_time = std::chrono::steady_clock::now();
+	for (uint i = 0; i < num_frames; ++i) {
+		for (Lanes::Input& input : inputs) {
+			if (next_random() % 8 == 0) {
+				input[0] ^= 1 << next_random() % 8;
+			}
+		}
+		if (num_lanes > 1) {
+			inputs[1] = inputs[0];
+		}
+		batch.Step(inputs);
+	}
+	const f64 total_sec = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start_time).count();
+
+	std::cout << std::format("Rom:           {}\n", rom_path);
+	std::cout << std::format("Lanes:         {}\n", num_lanes);
+	std::cout << std::format("Steps:         {}\n", num_frames);
+	std::cout << std::format("Host time:     {:.3f} s ({:.3f} ms per step)\n", total_sec, 1e3 * total_sec / num_frames);
+	std::cout << std::format("Frames/sec:    {:.2f} over all lanes\n", f64(num_frames) * num_lanes / total_sec);
+	if (num_lanes > 1) {
+		const std::span<const u8> ram = batch.GetRam();
+		bool ram_matches = true;
+		for (size_t addr = 0; addr < ram.size(); addr += num_lanes) {
+			ram_matches &= ram[addr] == ram[addr + 1];
+		}
+		std::cout << std::format("Lanes 0 and 1: the RAM {} (same input)\n", ram_matches ? "matches" : "DIFFERS");
+	}
+	return EXIT_SUCCESS;
+}
+
+
+int RunInstances(const std::string& rom_path, uint num_frames, uint num_instances)
+{
+	std::vector<std::unique_ptr<Emulator>> instances;
+	for (uint i = 0; i < num_instances; ++i) {
+		instances.push_back(std::make_unique<Emulator>());
+		if (!instances.back()->LoadRom(rom_path)) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	const auto start_time = std::chrono::steady_clock::now();
+	std::vector<std::future<void>> runs;
+	for (auto& instance : instances) {
+		runs.push_back(instance->RunFramesAsync(num_frames));
+	}
+	for (auto& run : runs) {
+		run.wait();
+	}
+	const auto end_time = std::chrono::steady_clock::now();
+
+	u64 cycles = 0, frames = 0;
+	for (auto& instance : instances) {
+		cycles += instance->GetCycleCount();
+		frames += instance->GetFrameCount();
+	}
+	const f64 total_sec = std::chrono::duration<f64>(end_time - start_time).count();
+
+	std::cout << std::format("Rom:           {}\n", rom_path);
+	std::cout << std::format("Instances:     {}\n", num_instances);
+	std::cout << std::format("Frames:        {}\n", frames);
+	std::cout << std::format("CPU cycles:    {}\n", cycles);
+	std::cout << std::format("Host time:     {:.3f} s\n", total_sec);
+	std::cout << std::format("Cycles/sec:    {:.0f} ({:.2f}x real time)\n",
+		cycles / total_sec, cycles / total_sec / System::standard.cpu_cycles_per_sec);
+	std::cout << std::format("Frames/sec:    {:.2f}\n", frames / total_sec);
+	return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		std::cerr << "Usage: NESBench <rom path> [number of frames] [number of instances]\n"
+			"       NESBench --dispatch <rom path> [number of frames]\n"
+			"       NESBench --core-diff <rom path> [number of frames]\n"
+			"       NESBench --opcodes <rom path> [number of executions per opcode]\n"
+			"       NESBench --profile <rom path> [number of frames]\n"
+			"       NESBench --run-ahead <rom path> [number of frames] [number of frames to run ahead]\n"
+			"       NESBench --rewind <rom path> [number of frames] [number of frames between captures]\n"
+			"       NESBench --movie <rom path> [number of frames] [number of frames between keyframes]\n"
+			"       NESBench --lanes <rom path> [number of frames] [number of lanes]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (std::string(argv[1]) == "--opcodes") {
+		const u64 num_executions = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 100000;
+		if (argc < 3 || num_executions == 0) {
+			std::cerr << "Usage: NESBench --opcodes <rom path> [number of executions per opcode]" << std::endl;
+			return EXIT_FAILURE;
+		}
+		return BenchmarkOpcodes(argv[2], uint(num_executions));
+	}
+	if (std::string(argv[1]) == "--run-ahead") {
+		const u64 num_frames = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 3600;
+		const u64 num_frames_ahead = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 1;
+		if (argc < 3 || num_frames == 0) {
+			std::cerr << "Usage: NESBench --run-ahead <rom path> [number of frames] [number of frames to run ahead]" << std::endl;
+			return EXIT_FAILURE;
+		}
+		return BenchmarkRunAhead(argv[2], uint(num_frames), uint(num_frames_ahead));
+	}
+	if (std::string(argv[1]) == "--rewind") {
+		const u64 num_frames = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 3600;
+		const u64 frame_interval = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 1;
+		if (argc < 3 || num_frames == 0 || frame_interval == 0) {
+			std::cerr << "Usage: NESBench --rewind <rom path> [number of frames] [number of frames between captures]" << std::endl;
+			return EXIT_FAILURE;
+		}
+		return BenchmarkRewind(argv[2], uint(num_frames), uint(frame_interval));
+	}
+	if (std::string(argv[1]) == "--movie") {
+		const u64 num_frames = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 36000;
+		const u64 keyframe_interval = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 600;
+		if (argc < 3 || num_frames == 0 || keyframe_interval == 0) {
+			std::cerr << "Usage: NESBench --movie <rom path> [number of frames] [number of frames between keyframes]" << std::endl;
+			return EXIT_FAILURE;
+		}
+		return BenchmarkMovie(argv[2], uint(num_frames), uint(keyframe_interval));
+	}
+	if (std::string(argv[1]) == "--lanes") {
+		const u64 num_frames = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 3600;
+		const u64 num_lanes = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 8;
+		if (argc < 3 || num_frames == 0 || num_lanes == 0) {
+			std::cerr << "Usage: NESBench --lanes <rom path> [number of frames] [number of lanes]" << std::endl;
+			return EXIT_FAILURE;
+		}
+		return BenchmarkLanes(argv[2], uint(num_frames), uint(num_lanes));
+	}
+	if (std::string(argv[1]) == "--dispatch" || std::string(argv[1]) == "--core-diff" || std::string(argv[1]) == "--profile") {
+		const u64 num_frames = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 3600;
+		if (argc < 3 || num_frames == 0) {
+			std::cerr << std::format("Usage: NESBench {} <rom path> [number of frames]", argv[1]) << std::endl;
+			return EXIT_FAILURE;
+		}
+		if (std::string(argv[1]) == "--dispatch") {
+			return CompareDispatchCores(argv[2], uint(num_frames));
+		}
+		if (std::string(argv[1]) == "--profile") {
+			return ProfileRom(argv[2], uint(num_frames));
+		}
+		return CompareBlockCacheWithInterpreter(argv[2], uint(num_frames));
+	}
+	const std::string rom_path = argv[1];
+	const u64 num_frames = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 3600;
+	const u64 num_instances = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1;
+	if (num_frames == 0 || num_instances == 0) {
+		std::cerr << "The number of frames and instances must be positive integers." << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (num_instances > 1) {
+		return RunInstances(rom_path, uint(num_frames), uint(num_instances));
+	}
+
+	if (!NES::LoadRom(rom_path)) {
+		return EXIT_FAILURE;
+	}
+	NES::Initialize();
+	System::ResetHostTimers();
+
+	const u64 start_cycles = CPU::GetCycleCount();
+	const u64 start_instructions = CPU::GetInstructionCount();
+	const u64 start_skipped_cycles = CPU::GetSkippedIdleCycles();
+	const u64 start_frames = PPU::GetFrameCount();
+	const auto start_time = std::chrono::steady_clock::now();
+	for (u64 i = 0; i < num_frames; ++i) {
+		NES::RunFrame();
+	}
+	const auto end_time = std::chrono::steady_clock::now();
+
+	const u64 cycles = CPU::GetCycleCount() - start_cycles;
+	const u64 instructions = CPU::GetInstructionCount() - start_instructions;
+	const u64 frames = PPU::GetFrameCount() - start_frames;
+	const f64 total_ns = f64(std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count());
+	const f64 total_sec = total_ns / 1e9;
+
+	std::cout << std::format("Rom:           {}\n", rom_path);
+	std::cout << std::format("Frames:        {}\n", frames);
+	std::cout << std::format("CPU cycles:    {}\n", cycles);
+	std::cout << std::format("Host time:     {:.3f} s\n", total_sec);
+	std::cout << std::format("Cycles/sec:    {:.0f} ({:.2f}x real time)\n",
+		cycles / total_sec, cycles / total_sec / System::standard.cpu_cycles_per_sec);
+	std::cout << std::format("Frames/sec:    {:.2f}\n", frames / total_sec);
+	std::cout << std::format("Instr/sec:     {:.0f}\n", instructions / total_sec);
+	if constexpr (CPU::skip_idle_loops) {
+		const u64 skipped_cycles = CPU::GetSkippedIdleCycles() - start_skipped_cycles;
+		std::cout << std::format("Idle skipped:  {} cycles ({:.1f} %)\n", skipped_cycles, 100.0 * skipped_cycles / cycles);
+	}
+
+	if constexpr (System::profile_subsystems) {
+		/* The component times are sampled estimates; the cpu share also includes the bus, mappers and the sampling itself. */
+		const f64 apu_ns = f64(System::GetApuHostTimeNs());
+		const f64 ppu_ns = f64(System::GetPpuHostTimeNs());
+		const f64 cpu_ns = total_ns > apu_ns + ppu_ns ? total_ns - apu_ns - ppu_ns : 0.0;
+		auto print_component = [&](const char* name, f64 ns) {
+			std::cout << std::format("  {}:  {:8.3f} s ({:5.1f} %)\n", name, ns / 1e9, 100.0 * ns / total_ns);
+		};
+		std::cout << "Host time per component:\n";
+		print_component("CPU", cpu_ns);
+		print_component("APU", apu_ns);
+		print_component("PPU", ppu_ns);
+	}
+
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+export module Audio;
+
+import NumericalTypes;
+
+/* Stand-in for the frontend audio module; samples produced by the APU are discarded. */
+export namespace Audio
+{
+	void EnqueueSample(f32 sample)
+	{
+	}
+
+
+	uint GetSampleRate()
+	{
+		return 44100;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+export module UserMessage;
+
+import <iostream>;
+import <string>;
+
+/* Stand-in for the frontend message box module; messages are printed to stderr instead. */
+export namespace UserMessage
+{
+	enum class Type {
+		Info, Warning, Error, Success
+	};
+
+	void Show(const std::string& message, Type type = Type::Info)
+	{
+		std::cerr << message << std::endl;
+	}
+}
\ No newline at end of file
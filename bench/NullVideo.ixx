@@ -0,0 +1,30 @@
+export module Video;
+
+import NumericalTypes;
+
+/* Stand-in for the frontend video module; frames produced by the PPU are never presented. */
+export namespace Video
+{
+	enum class PixelFormat {
+		RGB888, RGBA8888, BGRA8888, RGB565
+	};
+
+	void RenderGame()
+	{
+	}
+
+
+	void SetFramebufferPtr(u8* ptr)
+	{
+	}
+
+
+	void SetFramebufferSize(uint width, uint height)
+	{
+	}
+
+
+	void SetPixelFormat(PixelFormat format)
+	{
+	}
+}
\ No newline at end of file
@@ -3,19 +3,45 @@ module APU;
 import Bus;
 import Cartridge;
 import CPU;
+import Snapshot;
 import System;
 
 import Audio;
 
+import <algorithm>;
+
 namespace APU
 {
 	void ApplyNewSampleRate()
 	{
-		sample_rate = Audio::GetSampleRate();
+		sample_rate = sample_output ? sample_output_rate : Audio::GetSampleRate();
 		cpu_cycle_sample_counter = 0;
 	}
 
 
+	uint GetCpuCyclesUntilNextEvent()
+	{
+		/* The APU affects the cpu on its own only through the frame counter IRQ, and through the DMC (sample fetches stall the cpu, and can raise an IRQ).
+		   A pending $4017 write may change the frame counter mode at any time. */
+		if (frame_counter.pending_4017_write) {
+			return 0;
+		}
+		uint cpu_cycles = std::numeric_limits<uint>::max();
+		if (dmc.bytes_remaining > 0) {
+			/* A sample byte is fetched at the earliest on the DMC step that empties the shift register, 'bits_remaining' - 1 periods
+			   after the next output step. The DMC is stepped on every other cpu cycle, starting with the next one if 'on_apu_cycle' is set. */
+			const uint dmc_steps = dmc.apu_cycles_until_step + (dmc.bits_remaining - 1) * dmc.period;
+			cpu_cycles = dmc_steps > 0 ? 2 * dmc_steps - (on_apu_cycle ? 2 : 1) : 0;
+		}
+		if (frame_counter.mode == 0 && !frame_counter.interrupt_inhibit) {
+			/* The IRQ is raised when 'cpu_cycle_count' is incremented to table[3], and possibly again on the following two cycles. */
+			const uint irq_cycle = System::standard.frame_counter_step_cycle_table[3];
+			cpu_cycles = std::min(cpu_cycles, frame_counter.cpu_cycle_count < irq_cycle ? irq_cycle - frame_counter.cpu_cycle_count - 1 : 0);
+		}
+		return cpu_cycles;
+	}
+
+
 	void PowerOn()
 	{
 		for (u16 addr = 0x4000; addr <= 0x4013; addr++) {
@@ -734,6 +760,9 @@ namespace APU
 
 	void SampleAndMix()
 	{
+		if (!output_enabled) {
+			return;
+		}
 		// https://wiki.nesdev.org/w/index.php?title=APU_Mixer
 
 		static constexpr std::array pulse_table = [] {
@@ -763,8 +792,13 @@ namespace APU
 
 		auto output = pulse_out + tnd_out; /* [0, 2] */
 
-		Audio::EnqueueSample(output);
-		Audio::EnqueueSample(output);
+		if (sample_output) {
+			sample_output(output);
+		}
+		else {
+			Audio::EnqueueSample(output);
+			Audio::EnqueueSample(output);
+		}
 	}
 
 
@@ -796,8 +830,34 @@ namespace APU
 	}
 
 
-	void StreamState(SerializationStream& stream)
+	void SetOutputEnabled(bool enabled)
+	{
+		output_enabled = enabled;
+	}
+
+
+	void SetSampleOutput(std::function<void(f32)> output, uint output_sample_rate)
+	{
+		sample_output = std::move(output);
+		sample_output_rate = output_sample_rate;
+		ApplyNewSampleRate();
+	}
+
+
+	template<typename Stream>
+	void StreamState(Stream& stream)
 	{
-		// TODO
+		stream.StreamPrimitive(pulse_ch_1);
+		stream.StreamPrimitive(pulse_ch_2);
+		stream.StreamPrimitive(triangle_ch);
+		stream.StreamPrimitive(noise_ch);
+		stream.StreamPrimitive(dmc);
+		stream.StreamPrimitive(frame_counter);
+
+		stream.StreamPrimitive(on_apu_cycle);
+		stream.StreamPrimitive(cpu_cycle_sample_counter);
 	}
+
+	template void StreamState(SerializationStream&);
+	template void StreamState(Snapshot&);
 }
\ No newline at end of file
@@ -4,18 +4,28 @@ import NumericalTypes;
 import SerializationStream;
 
 import <array>;
+import <functional>;
+import <limits>;
+import <utility>;
 
 namespace APU
 {
 	export
 	{
 		void ApplyNewSampleRate();
+		uint GetCpuCyclesUntilNextEvent();
 		void Initialize();
 		u8 PeekRegister(u16 addr);
 		void PowerOn();
 		u8 ReadRegister(u16 addr);
 		void Reset();
-		void StreamState(SerializationStream& stream);
+		/* While cleared, no samples are passed on to the Audio module. */
+		void SetOutputEnabled(bool enabled);
+		/* When set, every (mono) sample is passed to 'output' instead of to the Audio module, on the thread running the
+		   console, and at 'output_sample_rate' rather than at Audio::GetSampleRate. This keeps the sound of each console apart,
+		   as the Audio module is shared by the whole process. Pass an empty function to go back to the Audio module. */
+		void SetSampleOutput(std::function<void(f32)> output, uint output_sample_rate);
+		template<typename Stream> void StreamState(Stream& stream);
 		void Update();
 		void WriteRegister(u16 addr, u8 data);
 	}
@@ -83,10 +93,10 @@ namespace APU
 		Sweep sweep;
 	};
 
-	PulseChannel<1> pulse_ch_1;
-	PulseChannel<2> pulse_ch_2;
+	thread_local PulseChannel<1> pulse_ch_1;
+	thread_local PulseChannel<2> pulse_ch_2;
 
-	struct TriangleChannel
+	thread_local struct TriangleChannel
 	{
 		void ClockLength();
 		void ClockLinear();
@@ -103,7 +113,7 @@ namespace APU
 		/* Note: the triangle channel does not have volume control; the waveform is either cycling or suspended. */
 	} triangle_ch;
 
-	struct NoiseChannel
+	thread_local struct NoiseChannel
 	{
 		void ClockEnvelope();
 		void ClockLength();
@@ -122,7 +132,7 @@ namespace APU
 		LengthCounter length_counter;
 	} noise_ch;
 
-	struct DMC
+	thread_local struct DMC
 	{
 		u8 GetOutput();
 		void ReadSampleByte();
@@ -147,7 +157,7 @@ namespace APU
 		u16 sample_length = 0;
 	} dmc;
 
-	struct FrameCounter
+	thread_local struct FrameCounter
 	{
 		void Step();
 
@@ -170,8 +180,12 @@ namespace APU
 	void SetDmcIrqLow();
 	void SetDmcIrqHigh();
 
-	bool on_apu_cycle = true;
+	thread_local bool on_apu_cycle = true;
+	thread_local bool output_enabled = true;
 
-	uint cpu_cycle_sample_counter;
-	uint sample_rate;
+	thread_local uint cpu_cycle_sample_counter;
+	thread_local uint sample_rate;
+	thread_local uint sample_output_rate;
+
+	thread_local std::function<void(f32)> sample_output; /* See SetSampleOutput. */
 }
\ No newline at end of file
@@ -5,6 +5,8 @@ import Cartridge;
 import Debug;
 import Joypad;
 import PPU;
+import Snapshot;
+import System;
 
 namespace Bus
 {
@@ -49,8 +51,44 @@ namespace Bus
 	}
 
 
+	std::span<const u8, 0x800> GetRam()
+	{
+		/* The internal RAM ($0000-$07FF), e.g. to observe it without a call to Peek per byte. */
+		return ram;
+	}
+
+
+	const u8* GetReadOnlyPage(u16 addr)
+	{
+		/* Returns the host memory of the page containing 'addr' if it is mapped for reads but not for writes (i.e. ROM), otherwise nullptr. */
+		uint page = addr / page_size;
+		return write_pages[page] == nullptr ? read_pages[page] : nullptr;
+	}
+
+
+	bool IsMapped(u16 addr)
+	{
+		/* Whether reads from 'addr' are served from plain memory through the page table, and thus have no side effects. */
+		return read_pages[addr / page_size] != nullptr;
+	}
+
+
+	void MapPages(u16 addr, uint size, u8* memory, bool writable)
+	{
+		/* 'addr' and 'size' must be multiples of the page size. */
+		for (uint page = addr / page_size; page < (addr + size) / page_size; ++page) {
+			read_pages[page] = memory;
+			write_pages[page] = writable ? memory : nullptr;
+			memory += page_size;
+		}
+	}
+
+
 	u8 Peek(u16 addr)
 	{
+		if (const u8* page = read_pages[addr / page_size]) {
+			return page[addr % page_size];
+		}
 		// Internal RAM ($0000 - $1FFF)
 		if (addr <= 0x1FFF) {
 			return ram[addr & 0x7FF]; // wrap address to between 0-0x7FF
@@ -87,11 +125,18 @@ namespace Bus
 	{
 		apu_io_test.fill(0);
 		ram.fill(0);
+		/* $0000-$1FFF: the 2 KiB of internal RAM, mirrored four times. */
+		for (u16 addr = 0; addr < 0x2000; addr += u16(ram.size())) {
+			MapPages(addr, uint(ram.size()), ram.data(), true);
+		}
 	}
 
 
 	u8 Read(u16 addr)
 	{
+		if (const u8* page = read_pages[addr / page_size]) {
+			return page[addr % page_size];
+		}
 		// Internal RAM ($0000 - $1FFF)
 		if (addr <= 0x1FFF) {
 			return ram[addr & 0x7FF]; // wrap address to between 0-0x7FF
@@ -102,10 +147,11 @@ namespace Bus
 		}
 		// PPU Registers ($2000 - $3FFF) 
 		else if (addr <= 0x3FFF) {
+			System::CatchUp();
 			// Wrap address to between 0x2000-0x2007
 			u8 value = PPU::ReadRegister(addr & 0x2007);
-			if constexpr (Debug::log_io) {
-				Debug::LogIoRead(addr & 0x2007, value);
+			if (Debug::tracer != nullptr) {
+				Debug::tracer->OnIoRead(addr & 0x2007, value);
 			}
 			return value;
 		}
@@ -114,16 +160,18 @@ namespace Bus
 			u8 value = [&] {
 				switch (addr) {
 				case Addr::OAMDMA: // $4014
+					System::CatchUp();
 					return PPU::ReadOAMDMA();
 				case Addr::JOY1: // $4016
 				case Addr::JOY2: // $4017
 					return Joypad::ReadRegister(addr);
 				default:
+					System::CatchUp();
 					return APU::ReadRegister(addr);
 				}
 			}();
-			if constexpr (Debug::log_io) {
-				Debug::LogIoRead(addr, value);
+			if (Debug::tracer != nullptr) {
+				Debug::tracer->OnIoRead(addr, value);
 			}
 			return value;
 		}
@@ -134,33 +182,53 @@ namespace Bus
 	}
 
 
-	void StreamState(SerializationStream& stream)
+	template<typename Stream>
+	void StreamState(Stream& stream)
 	{
 		stream.StreamArray(apu_io_test);
 		stream.StreamArray(ram);
 	}
 
+	template void StreamState(SerializationStream&);
+	template void StreamState(Snapshot&);
+
+
+	void UnmapPages(u16 addr, uint size)
+	{
+		for (uint page = addr / page_size; page < (addr + size) / page_size; ++page) {
+			read_pages[page] = write_pages[page] = nullptr;
+		}
+	}
+
 
 	void Write(u16 addr, u8 data)
 	{
+		if (u8* page = write_pages[addr / page_size]) {
+			page[addr % page_size] = data;
+			return;
+		}
 		// Internal RAM ($0000 - $1FFF)
 		if (addr <= 0x1FFF) {
 			ram[addr & 0x7FF] = data; // wrap address to between 0-0x7FF
 		}
 		// Cartridge Space ($4020 - $FFFF)
 		else if (addr >= 0x4020) {
+			/* Mapper writes may switch banks or mirroring seen by the PPU, or affect IRQ timing. */
+			System::CatchUp();
 			Cartridge::WritePRG(addr, data);
 		}
 		// PPU Registers ($2000 - $3FFF)
 		else if (addr <= 0x3FFF) {
+			System::CatchUp();
 			// wrap address to between 0x2000-0x2007 
 			PPU::WriteRegister(addr & 0x2007, data);
-			if constexpr (Debug::log_io) {
-				Debug::LogIoWrite(addr, data);
+			if (Debug::tracer != nullptr) {
+				Debug::tracer->OnIoWrite(addr, data);
 			}
 		}
 		// APU & I/O Registers ($4000-$4017)
 		else if (addr <= 0x4017) {
+			System::CatchUp();
 			switch (addr) {
 			case Addr::OAMDMA: // $4014
 				PPU::WriteOAMDMA(data);
@@ -173,8 +241,8 @@ namespace Bus
 				APU::WriteRegister(addr, data);
 				break;
 			}
-			if constexpr (Debug::log_io) {
-				Debug::LogIoWrite(addr, data);
+			if (Debug::tracer != nullptr) {
+				Debug::tracer->OnIoWrite(addr, data);
 			}
 		}
 		// APU Test Registers ($4018 - $401F)
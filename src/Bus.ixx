@@ -4,6 +4,7 @@ import NumericalTypes;
 import SerializationStream;
 
 import <array>;
+import <span>;
 import <string_view>;
 
 namespace Bus
@@ -52,14 +53,29 @@ namespace Bus
 			IRQ_BRK_VEC = 0xFFFE
 		};
 
+		/* The cpu address space is split into pages, each with a read and a write entry in a page table.
+		   An access to a page with a non-null entry goes straight to the host memory it points at; all other pages
+		   (I/O registers, mapper registers, open bus) take the slow path through the address decoding in Read/Write.
+		   Mappers map their PRG ROM and RAM pages, and remap them when their bank registers change. */
+		constexpr uint page_size = 0x400;
+		constexpr uint num_pages = 0x10000 / page_size;
+
+		std::span<const u8, 0x800> GetRam();
+		const u8* GetReadOnlyPage(u16 addr);
 		constexpr std::string_view IoAddrToString(u16 addr);
+		bool IsMapped(u16 addr);
+		void MapPages(u16 addr, uint size, u8* memory, bool writable);
 		u8 Read(u16 addr);
 		u8 Peek(u16 addr);
 		void PowerOn();
-		void StreamState(SerializationStream& stream);
+		template<typename Stream> void StreamState(Stream& stream);
+		void UnmapPages(u16 addr, uint size);
 		void Write(u16 addr, u8 data);
 	}
 
-	std::array<u8, 0x800> ram{}; /* $0000-$07FF, mirrored until $1FFF */
-	std::array<u8, 0x08> apu_io_test{}; /* $4018-$401F */
+	thread_local std::array<u8, 0x800> ram{}; /* $0000-$07FF, mirrored until $1FFF */
+	thread_local std::array<u8, 0x08> apu_io_test{}; /* $4018-$401F */
+
+	thread_local std::array<u8*, num_pages> read_pages{};
+	thread_local std::array<u8*, num_pages> write_pages{};
 }
\ No newline at end of file
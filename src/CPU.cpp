@@ -2,13 +2,74 @@ module CPU;
 
 import Bus;
 import Debug;
+import Snapshot;
 import System;
 import PPU;
 
+import <algorithm>;
+
 namespace CPU
 {
+	void EnableBusTrace(bool enable)
+	{
+		bus_trace_enabled = enable;
+		bus_trace_hash = 0xCBF2'9CE4'8422'2325;
+	}
+
+
+	AddrMode GetAddrMode(u8 opcode)
+	{
+		return opcode_table[opcode].addr_mode;
+	}
+
+
+	u64 GetCycleCount()
+	{
+		return total_cpu_cycle_counter;
+	}
+
+
+	u64 GetInstructionCount()
+	{
+		return instruction_counter;
+	}
+
+
+	std::string_view GetMnemonic(u8 opcode)
+	{
+		/* ASL, LSR, ROL and ROR have separate handlers for the accumulator (_A) and memory (_M) versions. */
+		std::string_view name = opcode_table[opcode].name;
+		return name.substr(0, name.find('_'));
+	}
+
+
+	u64 GetSkippedIdleCycles()
+	{
+		return skipped_idle_cycles;
+	}
+
+
+	TraceState GetTraceState()
+	{
+		return {
+			.bus_hash = bus_trace_hash,
+			.cycles = total_cpu_cycle_counter,
+			.instructions = instruction_counter,
+			.pc = pc,
+			.a = A,
+			.x = X,
+			.y = Y,
+			.p = GetStatusRegInterrupt(),
+			.sp = sp
+		};
+	}
+
+
 	void PowerOn()
 	{
+		/* Cached blocks point into the PRG ROM of the cartridge that was loaded before. */
+		ClearBlockCache();
+		idle_loop.recording = false;
 		Reset(false /* do not jump to reset vector */);
 		SetStatusReg(0x34);
 		A = X = Y = 0;
@@ -44,32 +105,87 @@ namespace CPU
 	}
 
 
-	void Run()
+	template<DispatchCore core>
+	uint Run(uint num_cycles)
 	{
-		/* Run the CPU for 10,000 cycles. A frame is roughly 30,000 cpu cycles. 
-		Exact timing is not important; audio/video synchronization is done by the APU. */
+		/* Run the CPU for at least 'num_cycles' cycles, up to the end of the instruction (or interrupt sequence) during which
+		   they have elapsed, or until StopRun is called. Returns the number of cycles that were run. */
 		cpu_cycle_counter = 0; /* The ReadCycle/WriteCycle/WaitCycle functions increment this variable. */
+		cycles_to_run = num_cycles;
 		if (stopped) {
-			while (cpu_cycle_counter < cycle_run_len) {
+			while (cpu_cycle_counter < cycles_to_run) {
 				WaitCycle();
 			}
 		}
+		else if (Debug::tracer != nullptr) {
+			/* The hooks only exist in this instantiation of the loop, so that they cost nothing while no tracer is attached. */
+			RunInstructions<core, true>();
+		}
 		else {
-			while (cpu_cycle_counter < cycle_run_len) {
-				if (write_to_irq_disable_flag_before_next_instr) {
-					status.irq_disable = bit_to_write_to_irq_disable_flag;
-					write_to_irq_disable_flag_before_next_instr = false;
-				}
-				FetchDecodeExecuteInstruction();
-				// Check for pending interrupts (NMI and IRQ); NMI has higher priority than IRQ
-				// Interrupts are only polled after executing an instruction; multiple interrupts cannot be serviced in a row
-				if (polled_need_nmi) {
-					ServiceInterrupt<InterruptType::NMI>();
+			RunInstructions<core, false>();
+		}
+		System::CatchUp();
+		total_cpu_cycle_counter += cpu_cycle_counter;
+		return cpu_cycle_counter;
+	}
+
+	template uint Run<DispatchCore::FunctionTable>(uint);
+	template uint Run<DispatchCore::Switch>(uint);
+	template uint Run<DispatchCore::BlockCache>(uint);
+
+
+	template<DispatchCore core, bool traced>
+	void RunInstructions()
+	{
+		while (cpu_cycle_counter < cycles_to_run) {
+			const CachedInstruction* cached_instr = nullptr;
+			if constexpr (core == DispatchCore::BlockCache) {
+				cached_instr = GetCachedInstruction();
+			}
+			StepInstruction<core, traced>(cached_instr);
+		}
+	}
+
+
+	void ExecuteOpcode(u8 opcode)
+	{
+		/* Executes a single instruction with the given opcode, placed in RAM at $0000 and followed by zero operand bytes.
+		   A, X and Y are cleared first, so that every address that the instruction computes lies in RAM (or, for BRK, is
+		   the interrupt vector). Used to benchmark single instructions (see NESBench --opcodes); interrupts are not serviced. */
+		Bus::Write(0x0000, opcode);
+		Bus::Write(0x0001, 0);
+		Bus::Write(0x0002, 0);
+		A = X = Y = 0;
+		pc = 0x0000;
+		FetchDecodeExecuteInstruction<dispatch_core, false>(nullptr);
+	}
+
+
+	template<DispatchCore core, bool traced>
+	void StepInstruction(const CachedInstruction* cached_instr)
+	{
+		if (write_to_irq_disable_flag_before_next_instr) {
+			status.irq_disable = bit_to_write_to_irq_disable_flag;
+			write_to_irq_disable_flag_before_next_instr = false;
+		}
+		FetchDecodeExecuteInstruction<core, traced>(cached_instr);
+		// Check for pending interrupts (NMI and IRQ); NMI has higher priority than IRQ
+		// Interrupts are only polled after executing an instruction; multiple interrupts cannot be serviced in a row
+		if (polled_need_nmi) {
+			if constexpr (traced) {
+				if (Debug::tracer != nullptr) {
+					Debug::tracer->OnInterrupt(InterruptType::NMI, total_cpu_cycle_counter + cpu_cycle_counter);
 				}
-				else if (polled_need_irq && !status.irq_disable) {
-					ServiceInterrupt<InterruptType::IRQ>();
+			}
+			ServiceInterrupt<InterruptType::NMI>();
+		}
+		else if (polled_need_irq && !status.irq_disable) {
+			if constexpr (traced) {
+				if (Debug::tracer != nullptr) {
+					Debug::tracer->OnInterrupt(InterruptType::IRQ, total_cpu_cycle_counter + cpu_cycle_counter);
 				}
 			}
+			ServiceInterrupt<InterruptType::IRQ>();
 		}
 	}
 
@@ -81,6 +197,7 @@ namespace CPU
 		* Note: Components are always stepped in the following order: CPU, APU, PPU.
 		* This function was called from the APU. However, calling WaitCycle results in a stepping of 
 		* the APU, and the PPU. Thus, we should step the PPU manually once, before calling WaitCycle. */
+		idle_loop.recording = false; /* The iteration took longer than the following ones would. */
 		PPU::Update();
 		for (int i = 0; i < 4; ++i) {
 			WaitCycle();
@@ -88,11 +205,18 @@ namespace CPU
 	}
 
 
+	void StopRun()
+	{
+		/* Called from the components while they are stepped, i.e. in the middle of an instruction, which is completed. */
+		cycles_to_run = std::min(cycles_to_run, cpu_cycle_counter);
+	}
+
+
 	void PerformOamDmaTransfer(u8 page, u8* oam_start_ptr, u8 offset)
 	{
 		u16 src_addr = page << 8;
-		if constexpr (Debug::log_dma) {
-			Debug::LogDma(src_addr);
+		if (Debug::tracer != nullptr) {
+			Debug::tracer->OnDma(src_addr);
 		}
 		WaitCycle();
 		if (odd_cpu_cycle) {
@@ -129,6 +253,14 @@ namespace CPU
 	}
 
 
+	bool InterruptInputsAreSettled()
+	{
+		/* True if polling the interrupt inputs again would not change anything, as long as the NMI and IRQ lines stay as they are.
+		   Only then may the stepping of the other components be deferred (see System::StepAllComponentsButCpu). */
+		return polled_nmi_line == nmi_line && prev_polled_nmi_line == nmi_line && need_irq == (irq_line != 0xFF);
+	}
+
+
 	void PollInterruptOutputs()
 	{
 		/* This function is called at the start of each CPU cycle.
@@ -175,6 +307,7 @@ namespace CPU
 	{
 		StartCycle();
 		u8 value = Bus::Read(addr);
+		TraceBusAccess(addr, value, false);
 		System::StepAllComponentsButCpu();
 		return value;
 	}
@@ -184,6 +317,7 @@ namespace CPU
 	{
 		StartCycle();
 		Bus::Write(addr, data);
+		TraceBusAccess(addr, data, true);
 		System::StepAllComponentsButCpu();
 	}
 
@@ -195,6 +329,109 @@ namespace CPU
 	}
 
 
+	void TraceBusAccess(u16 addr, u8 data, bool write)
+	{
+		if (bus_trace_enabled) {
+			HashBusAccess(addr, data, write);
+		}
+		if constexpr (skip_idle_loops) {
+			if (idle_loop.recording) {
+				RecordIdleLoopAccess(addr, data, write);
+			}
+		}
+	}
+
+
+	void HashBusAccess(u16 addr, u8 data, bool write)
+	{
+		for (u8 byte : { u8(addr & 0xFF), u8(addr >> 8), data, u8(write) }) {
+			bus_trace_hash = (bus_trace_hash ^ byte) * 0x100'0000'01B3;
+		}
+	}
+
+
+	void CheckIdleLoop()
+	{
+		/* Called after a jump or taken branch backwards, to 'pc'. If the previous jump back went to the same address, and the
+		   iteration in between only read memory that cannot change on its own (RAM, PRG) or PPUSTATUS without clearing its
+		   vblank flag, and it left the registers as they were, then the next iteration will be identical, and so will every one
+		   after it, until an interrupt arrives or PPUSTATUS changes. These iterations are skipped up to the next event of the
+		   other components, which are later caught up in one go, exactly as with any other deferred cycles. */
+		if (idle_loop.recording && idle_loop.head == pc && idle_loop.a == A && idle_loop.x == X && idle_loop.y == Y &&
+			idle_loop.p == GetStatusRegInterrupt() && idle_loop.sp == sp && !polled_need_nmi &&
+			!(polled_need_irq && !status.irq_disable) && !write_to_irq_disable_flag_before_next_instr &&
+			Debug::tracer == nullptr)
+		{
+			SkipIdleLoopIterations(uint(total_cpu_cycle_counter + cpu_cycle_counter - idle_loop.start_cycle),
+				uint(instruction_counter - idle_loop.start_instruction));
+		}
+		idle_loop.num_accesses = 0;
+		idle_loop.start_cycle = total_cpu_cycle_counter + cpu_cycle_counter;
+		idle_loop.start_instruction = instruction_counter;
+		idle_loop.head = pc;
+		idle_loop.a = A;
+		idle_loop.x = X;
+		idle_loop.y = Y;
+		idle_loop.p = GetStatusRegInterrupt();
+		idle_loop.sp = sp;
+		idle_loop.reads_ppustatus = false;
+		idle_loop.recording = true;
+	}
+
+
+	void RecordIdleLoopAccess(u16 addr, u8 data, bool write)
+	{
+		const bool is_ppustatus = addr >= 0x2000 && addr < 0x4000 && (addr & 7) == 2;
+		if (write || idle_loop.num_accesses == max_idle_loop_accesses ||
+			!(Bus::IsMapped(addr) || is_ppustatus && !(data & 0x80)))
+		{
+			idle_loop.recording = false;
+			return;
+		}
+		idle_loop.accesses[idle_loop.num_accesses++] = { addr, data };
+		idle_loop.reads_ppustatus |= is_ppustatus;
+	}
+
+
+	void SkipIdleLoopIterations(uint iteration_cycles, uint iteration_instructions)
+	{
+		/* Iterations are only skipped as long as Run would not have returned during them. */
+		if (cpu_cycle_counter >= cycles_to_run) {
+			return;
+		}
+		uint max_cycles = std::min(System::GetCpuCyclesUntilNextEvent(), cycles_to_run - cpu_cycle_counter);
+		if (idle_loop.reads_ppustatus) {
+			/* PPUSTATUS may already have changed since it was read during the iteration (e.g. a sprite 0 hit later in it), in
+			   which case the next iteration would differ. Otherwise, it stays the same until the PPU predicts it to change. */
+			for (uint i = 0; i < idle_loop.num_accesses; ++i) {
+				if (idle_loop.accesses[i].addr >= 0x2000 && idle_loop.accesses[i].addr < 0x4000 &&
+					Bus::Peek(idle_loop.accesses[i].addr) != idle_loop.accesses[i].data)
+				{
+					return;
+				}
+			}
+			max_cycles = std::min(max_cycles, System::GetCpuCyclesUntilPpuStatusChange());
+		}
+		const uint num_iterations = max_cycles / iteration_cycles;
+		if (num_iterations == 0) {
+			return;
+		}
+		const uint num_cycles = num_iterations * iteration_cycles;
+		cpu_cycle_counter += num_cycles;
+		odd_cpu_cycle ^= num_cycles & 1;
+		instruction_counter += u64(num_iterations) * iteration_instructions;
+		skipped_idle_cycles += num_cycles;
+		System::DeferCpuCycles(num_cycles);
+		if (bus_trace_enabled) {
+			for (uint i = 0; i < num_iterations; ++i) {
+				for (uint j = 0; j < idle_loop.num_accesses; ++j) {
+					HashBusAccess(idle_loop.accesses[j].addr, idle_loop.accesses[j].data, false);
+				}
+			}
+		}
+	}
+
+
 	void PushByteToStack(u8 byte)
 	{
 		WriteCycle(0x0100 | sp--, byte);
@@ -240,6 +477,11 @@ namespace CPU
 				WaitCycle();
 			}
 			pc += offset;
+			if constexpr (skip_idle_loops) {
+				if (offset < 0) {
+					CheckIdleLoop();
+				}
+			}
 		}
 	}
 
@@ -249,13 +491,13 @@ namespace CPU
 	u8 GetStatusRegInstr()
 	{
 		static constexpr bool bit4 = instr == BRK || instr == PHP;
-		return status.neg        << 7
+		return status.Neg()      << 7
 			| status.overflow    << 6
 			| 1                  << 5
 			| bit4               << 4
 			| status.decimal     << 3 
 			| status.irq_disable << 2
-			| status.zero        << 1
+			| status.Zero()      << 1
 			| status.carry       << 0;
 	}
 
@@ -263,12 +505,12 @@ namespace CPU
 	// called when an interrupt is being serviced and the status register is pushed to the stack
 	u8 GetStatusRegInterrupt()
 	{
-		return status.neg        << 7
+		return status.Neg()      << 7
 			| status.overflow    << 6
 			| 1                  << 5 
 			| status.decimal     << 3
 			| status.irq_disable << 2
-			| status.zero        << 1
+			| status.Zero()      << 1
 			| status.carry       << 0;
 	}
 
@@ -276,32 +518,153 @@ namespace CPU
 	void SetStatusReg(u8 value)
 	{
 		/* Keep the value of the upper bit of B (bit 5) */
-		status.neg         = value & 0x80;
+		status.SetZeroAndNeg(value & 0x02, value & 0x80);
 		status.overflow    = value & 0x40;
 		status.b           = value & 0x10;
 		status.decimal     = value & 0x08;
 		status.irq_disable = value & 0x04;
-		status.zero        = value & 0x02;
 		status.carry       = value & 0x01;
 	}
 
 
-	void FetchDecodeExecuteInstruction()
+	template<DispatchCore core, bool traced>
+	void FetchDecodeExecuteInstruction(const CachedInstruction* cached_instr)
 	{
-		opcode = ReadCycle(pc);
-		if constexpr (Debug::log_instr) {
-			Debug::LogInstr(
-				opcode,
-				A,
-				X,
-				Y,
-				GetStatusRegInterrupt() & ~0x20,
-				sp,
-				pc
-			);
+		if (cached_instr) {
+			/* A read from ROM has no side effects, so only the cycle itself needs to be performed. */
+			StartCycle();
+			opcode = cached_instr->opcode;
+			TraceBusAccess(pc, opcode, false);
+			System::StepAllComponentsButCpu();
+		}
+		else {
+			opcode = ReadCycle(pc);
+		}
+		if constexpr (traced) {
+			if (Debug::tracer != nullptr) {
+				Debug::tracer->OnInstruction({
+					.cycle = total_cpu_cycle_counter + cpu_cycle_counter - 1,
+					.pc = pc,
+					.opcode = opcode,
+					.a = A,
+					.x = X,
+					.y = Y,
+					.p = u8(GetStatusRegInterrupt() & ~0x20),
+					.sp = sp
+				});
+			}
 		}
 		pc++;
-		instr_table[opcode]();
+		instruction_counter++;
+		if constexpr (core == DispatchCore::Switch) {
+			ExecuteInstructionSwitch(opcode);
+		}
+		else if (cached_instr) {
+			cached_operand = cached_instr->operands.data();
+			cached_instr->handler();
+		}
+		else {
+			instr_table[opcode]();
+		}
+	}
+
+
+	const CachedInstruction* GetCachedInstruction()
+	{
+		/* Stay in the current block as long as execution falls through to its next instruction, and its page is still
+		   mapped to the same PRG bank. Otherwise (jumps, taken branches, interrupts, bank switches), look up a new one. */
+		if (current_block == nullptr || current_block_index == current_block->length || pc != current_block_pc ||
+			Bus::GetReadOnlyPage(pc) != current_block->page)
+		{
+			current_block = GetBlock(pc);
+			if (current_block == nullptr) {
+				return nullptr;
+			}
+			current_block_index = 0;
+		}
+		const CachedInstruction* instr = &current_block->instrs[current_block_index++];
+		current_block_pc = pc + instr->length;
+		return instr;
+	}
+
+
+	const Block* GetBlock(u16 addr)
+	{
+		/* Only code in read-only pages is cached, so that blocks never have to be invalidated because of writes.
+		   A bank switch changes the host address of the page, and with it the tag. */
+		const u8* page = Bus::GetReadOnlyPage(addr);
+		if (page == nullptr) {
+			return nullptr;
+		}
+		Block& block = block_cache[addr % block_cache_size];
+		if (block.start != page + addr % Bus::page_size) {
+			DecodeBlock(block, page, addr % Bus::page_size);
+		}
+		return block.length > 0 ? &block : nullptr;
+	}
+
+
+	void DecodeBlock(Block& block, const u8* page, uint offset)
+	{
+		block.start = page + offset;
+		block.page = page;
+		block.length = 0;
+		while (block.length < max_block_length) {
+			const u8 block_opcode = page[offset];
+			const uint length = 1 + GetOperandLength(opcode_table[block_opcode].addr_mode);
+			if (offset + length > Bus::page_size) {
+				break;
+			}
+			CachedInstruction& instr = block.instrs[block.length++];
+			instr.handler = cached_instr_table[block_opcode];
+			instr.opcode = block_opcode;
+			instr.length = u8(length);
+			instr.operands[0] = length > 1 ? page[offset + 1] : 0;
+			instr.operands[1] = length > 2 ? page[offset + 2] : 0;
+			offset += length;
+			const Instruction block_instr = opcode_table[block_opcode].instr;
+			if (block_instr == BRK || block_instr == JMP || block_instr == JSR || block_instr == RTI || block_instr == RTS || block_instr == STP) {
+				break;
+			}
+		}
+	}
+
+
+	void ClearBlockCache()
+	{
+		block_cache.fill({});
+		current_block = nullptr;
+	}
+
+
+	u8 FetchCachedOperandCycle()
+	{
+		/* Like ReadCycle(pc++), but the byte comes from the block; it is in ROM, so the bus access has no side effects. */
+		StartCycle();
+		u8 value = *cached_operand++;
+		TraceBusAccess(pc++, value, false);
+		System::StepAllComponentsButCpu();
+		return value;
+	}
+
+
+	void ExecuteInstructionSwitch(const u8 opcode)
+	{
+		/* One case per opcode, each a direct call to the same ExecuteInstruction instantiation that 'instr_table' holds. */
+		switch (opcode) {
+#define CASE(OPCODE) case OPCODE: ExecuteInstruction<opcode_table[OPCODE].instr, opcode_table[OPCODE].addr_mode>(); break;
+#define CASE4(OPCODE) CASE(OPCODE) CASE(OPCODE + 1) CASE(OPCODE + 2) CASE(OPCODE + 3)
+#define CASE16(OPCODE) CASE4(OPCODE) CASE4(OPCODE + 4) CASE4(OPCODE + 8) CASE4(OPCODE + 12)
+#define CASE64(OPCODE) CASE16(OPCODE) CASE16(OPCODE + 16) CASE16(OPCODE + 32) CASE16(OPCODE + 48)
+			CASE64(0x00)
+			CASE64(0x40)
+			CASE64(0x80)
+			CASE64(0xC0)
+#undef CASE
+#undef CASE4
+#undef CASE16
+#undef CASE64
+		}
 	}
 
 
@@ -345,6 +708,9 @@ namespace CPU
 		// The same applies to IRQ and BRK; an IRQ can hijack a BRK
 		if (asserted_interrupt_type == InterruptType::NMI || polled_need_nmi) {
 			handled_interrupt_type = InterruptType::NMI;
+			/* The interrupt inputs are changed below without the other components being involved; any deferred component updates
+			   (during which the inputs would have been polled) must be carried out before that. */
+			System::CatchUp();
 			need_irq = polled_need_irq = false; /* The possible pending status of the IRQ is forgotten */
 		}
 		else {
@@ -362,11 +728,13 @@ namespace CPU
 		// cycles 6-7
 		if (handled_interrupt_type == InterruptType::NMI) {
 			pc = ReadWord(Bus::Addr::NMI_VEC);
+			System::CatchUp();
 			need_nmi = polled_need_nmi = false; // todo: it's not entirely clear if this is the right place to clear this.
 			nmi_line = polled_nmi_line = prev_polled_nmi_line = 1; /* TODO should NMI line even be set, or is it the job of the interrupt handler? */
 		}
 		else {
 			pc = ReadWord(Bus::Addr::IRQ_BRK_VEC);
+			System::CatchUp();
 			need_irq = polled_need_irq = false;
 		}
 
@@ -387,8 +755,7 @@ namespace CPU
 		status.carry = sum > 0xFF;
 		status.overflow = (A ^ sum) & (operand ^ sum) & 0x80;
 		A = sum & 0xFF;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -396,8 +763,7 @@ namespace CPU
 	void AND()
 	{
 		A &= operand;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -406,8 +772,7 @@ namespace CPU
 	{
 		status.carry = A & 0x80;
 		A <<= 1;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -418,8 +783,7 @@ namespace CPU
 		u8 result = operand << 1;
 		WriteCycle(addr, result);
 		status.carry = operand & 0x80;
-		status.zero = result == 0;
-		status.neg = result & 0x80;
+		status.SetNZ(result);
 	}
 
 
@@ -440,37 +804,36 @@ namespace CPU
 	// If the zero flag is set then add the relative displacement to the program counter to cause a branch to a new location.
 	void BEQ()
 	{
-		Branch(status.zero);
+		Branch(status.Zero());
 	}
 
 
 	// Check the bitwise AND between the accumulator and the contents of a memory location, and set the status flags accordingly.
 	void BIT()
 	{
-		status.zero = (A & operand) == 0;
+		status.SetZeroAndNeg((A & operand) == 0, operand & 0x80);
 		status.overflow = operand & 0x40; /* Note: this does not depend on the AND */
-		status.neg = operand & 0x80;
 	}
 
 
 	// If the negative flag is set then add the relative displacement to the program counter to cause a branch to a new location.
 	void BMI()
 	{
-		Branch(status.neg);
+		Branch(status.Neg());
 	}
 
 
 	// If the zero flag is clear then add the relative displacement to the program counter to cause a branch to a new location.
 	void BNE()
 	{
-		Branch(!status.zero);
+		Branch(!status.Zero());
 	}
 
 
 	// If the negative flag is clear then add the relative displacement to the program counter to cause a branch to a new location.
 	void BPL()
 	{
-		Branch(!status.neg);
+		Branch(!status.Neg());
 	}
 
 
@@ -529,9 +892,7 @@ namespace CPU
 	void CMP()
 	{
 		status.carry = A >= operand;
-		status.zero = A == operand;
-		u8 result = A - operand;
-		status.neg = result & 0x80;
+		status.SetNZ(A - operand);
 	}
 
 
@@ -539,9 +900,7 @@ namespace CPU
 	void CPX()
 	{
 		status.carry = X >= operand;
-		status.zero = X == operand;
-		u8 result = X - operand;
-		status.neg = result & 0x80;
+		status.SetNZ(X - operand);
 	}
 
 
@@ -549,9 +908,7 @@ namespace CPU
 	void CPY()
 	{
 		status.carry = Y >= operand;
-		status.zero = Y == operand;
-		u8 result = Y - operand;
-		status.neg = result & 0x80;
+		status.SetNZ(Y - operand);
 	}
 
 
@@ -561,8 +918,7 @@ namespace CPU
 		WriteCycle(addr, operand); /* Dummy write */
 		u8 result = operand - 1;
 		WriteCycle(addr, result);
-		status.zero = result == 0;
-		status.neg = result & 0x80;
+		status.SetNZ(result);
 	}
 
 
@@ -570,8 +926,7 @@ namespace CPU
 	void DEX()
 	{
 		--X;
-		status.zero = X == 0;
-		status.neg = X & 0x80;
+		status.SetNZ(X);
 	}
 
 
@@ -579,8 +934,7 @@ namespace CPU
 	void DEY()
 	{
 		--Y;
-		status.zero = Y == 0;
-		status.neg = Y & 0x80;
+		status.SetNZ(Y);
 	}
 
 
@@ -588,8 +942,7 @@ namespace CPU
 	void EOR()
 	{
 		A ^= operand;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -599,8 +952,7 @@ namespace CPU
 		WriteCycle(addr, operand); /* Dummy write */
 		u8 result = operand + 1;
 		WriteCycle(addr, result);
-		status.zero = result == 0;
-		status.neg = result & 0x80;
+		status.SetNZ(result);
 	}
 
 
@@ -608,8 +960,7 @@ namespace CPU
 	void INX()
 	{
 		++X;
-		status.zero = X == 0;
-		status.neg = X & 0x80;
+		status.SetNZ(X);
 	}
 
 
@@ -617,15 +968,20 @@ namespace CPU
 	void INY()
 	{
 		++Y;
-		status.zero = Y == 0;
-		status.neg = Y & 0x80;
+		status.SetNZ(Y);
 	}
 
 
 	// Set the program counter to the address specified by the operand.
 	void JMP()
 	{
+		const bool backwards = addr < pc;
 		pc = addr;
+		if constexpr (skip_idle_loops) {
+			if (backwards) {
+				CheckIdleLoop();
+			}
+		}
 	}
 
 
@@ -642,8 +998,7 @@ namespace CPU
 	void LDA()
 	{
 		A = operand;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -651,8 +1006,7 @@ namespace CPU
 	void LDX()
 	{
 		X = operand;
-		status.zero = X == 0;
-		status.neg = X & 0x80;
+		status.SetNZ(X);
 	}
 
 
@@ -660,8 +1014,7 @@ namespace CPU
 	void LDY()
 	{
 		Y = operand;
-		status.zero = Y == 0;
-		status.neg = Y & 0x80;
+		status.SetNZ(Y);
 	}
 
 
@@ -670,8 +1023,7 @@ namespace CPU
 	{
 		status.carry = A & 1;
 		A >>= 1;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -682,8 +1034,7 @@ namespace CPU
 		u8 result = operand >> 1;
 		WriteCycle(addr, result);
 		status.carry = operand & 1;
-		status.zero = result == 0;
-		status.neg = result & 0x80;
+		status.SetNZ(result);
 	}
 
 
@@ -698,8 +1049,7 @@ namespace CPU
 	void ORA()
 	{
 		A |= operand;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -721,8 +1071,7 @@ namespace CPU
 	void PLA()
 	{
 		A = PullByteFromStack();
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 		WaitCycle();
 	}
 
@@ -746,8 +1095,7 @@ namespace CPU
 		bool new_carry = A & 0x80;
 		A = A << 1 | status.carry;
 		status.carry = new_carry;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -759,8 +1107,7 @@ namespace CPU
 		u8 result = operand << 1 | status.carry;
 		WriteCycle(addr, result);
 		status.carry = new_carry;
-		status.zero = result == 0;
-		status.neg = result & 0x80;
+		status.SetNZ(result);
 	}
 
 
@@ -770,8 +1117,7 @@ namespace CPU
 		bool new_carry = A & 1;
 		A = A >> 1 | status.carry << 7;
 		status.carry = new_carry;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -783,8 +1129,7 @@ namespace CPU
 		u8 result = operand >> 1 | status.carry << 7;
 		WriteCycle(addr, result);
 		status.carry = new_carry;
-		status.zero = result == 0;
-		status.neg = result & 0x80;
+		status.SetNZ(result);
 	}
 
 
@@ -815,8 +1160,7 @@ namespace CPU
 		status.carry = sum > 0xFF;
 		status.overflow = (A ^ sum) & (operand ^ sum) & 0x80;
 		A = sum & 0xFF;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -868,8 +1212,7 @@ namespace CPU
 	void TAX()
 	{
 		X = A;
-		status.zero = X == 0;
-		status.neg = X & 0x80;
+		status.SetNZ(X);
 	}
 
 
@@ -877,8 +1220,7 @@ namespace CPU
 	void TAY()
 	{
 		Y = A;
-		status.zero = Y == 0;
-		status.neg = Y & 0x80;
+		status.SetNZ(Y);
 	}
 
 
@@ -886,8 +1228,7 @@ namespace CPU
 	void TSX()
 	{
 		X = sp;
-		status.zero = X == 0;
-		status.neg = X & 0x80;
+		status.SetNZ(X);
 	}
 
 
@@ -895,8 +1236,7 @@ namespace CPU
 	void TXA()
 	{
 		A = X;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -911,8 +1251,7 @@ namespace CPU
 	void TYA()
 	{
 		A = Y;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -933,8 +1272,7 @@ namespace CPU
 		// LSR
 		status.carry = A & 1;
 		A >>= 1;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -943,9 +1281,8 @@ namespace CPU
 	{
 		u8 M = read_addr;
 		A &= M;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
-		status.carry = status.neg;
+		status.SetNZ(A);
+		status.carry = A & 0x80;
 	}
 
 
@@ -954,8 +1291,7 @@ namespace CPU
 	{
 		u8 M = read_addr;
 		A = (A & M) >> 1 | status.carry << 7;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 		status.carry = A & 0x40; /* Source: Mesen source code; CPU.h */
 		status.overflow = status.carry ^ (A >> 5 & 0x01); /* Source: Mesen source code; CPU.h */
 	}
@@ -966,9 +1302,8 @@ namespace CPU
 	{
 		u8 M = read_addr;
 		status.carry = (A & X) >= M;
-		status.zero = (A & X) == M;
 		u8 result = (A & X) - M;
-		status.neg = result & 0x80;
+		status.SetNZ(result);
 		X = result; /* Source: Mesen source code; CPU.h */
 	}
 
@@ -982,9 +1317,7 @@ namespace CPU
 		WriteCycle(addr, result);
 		// CMP
 		status.carry = A >= result;
-		status.zero = A == result;
-		result = A - result;
-		status.neg = result & 0x80;
+		status.SetNZ(A - result);
 	}
 
 
@@ -1002,8 +1335,7 @@ namespace CPU
 		status.carry = sum > 0xFF;
 		status.overflow = (A ^ sum) & (result ^ sum) & 0x80;
 		A = sum & 0xFF;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -1011,8 +1343,7 @@ namespace CPU
 	void LAS() // LAR
 	{
 		A = X = sp = operand & sp;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -1023,8 +1354,7 @@ namespace CPU
 		A = operand;
 		// LDX
 		X = operand;
-		status.zero = X == 0;
-		status.neg = X & 0x80;
+		status.SetNZ(X);
 	}
 
 
@@ -1040,8 +1370,7 @@ namespace CPU
 		status.carry = new_carry;
 		// AND
 		A &= result;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -1059,8 +1388,7 @@ namespace CPU
 		status.carry = sum > 0xFF;
 		status.overflow = (A ^ sum) & (result ^ sum) & 0x80;
 		A = sum & 0xFF;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -1101,8 +1429,7 @@ namespace CPU
 		status.carry = operand & 0x80;
 		// ORA
 		A |= result;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -1116,8 +1443,7 @@ namespace CPU
 		status.carry = operand & 1;
 		// EOR
 		A ^= result;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
@@ -1126,7 +1452,7 @@ namespace CPU
 	{
 		stopped = true;
 		/* Idle until the end of the "cpu update" */
-		while (cpu_cycle_counter < cycle_run_len) {
+		while (cpu_cycle_counter < cycles_to_run) {
 			WaitCycle();
 		}
 	}
@@ -1147,19 +1473,25 @@ namespace CPU
 		// Use CONST = 0
 		u8 M = read_addr;
 		A &= X & M;
-		status.zero = A == 0;
-		status.neg = A & 0x80;
+		status.SetNZ(A);
 	}
 
 
-	void StreamState(SerializationStream& stream)
+	template<typename Stream>
+	void StreamState(Stream& stream)
 	{
+		idle_loop.recording = false;
 		stream.StreamPrimitive(A);
 		stream.StreamPrimitive(X);
 		stream.StreamPrimitive(Y);
 		stream.StreamPrimitive(sp);
 		stream.StreamPrimitive(pc);
-		stream.StreamPrimitive(status);
+		/* The status register as the byte pushed to the stack, rather than the Status struct, whose layout depends on
+		   NES_CPU_LAZY_FLAGS; a state saved with lazy flags can then be loaded without them, and vice versa. Setting the
+		   register from the byte when saving leaves the flags as they are. */
+		u8 status_reg = GetStatusRegInterrupt() | status.b << 4;
+		stream.StreamPrimitive(status_reg);
+		SetStatusReg(status_reg);
 
 		stream.StreamPrimitive(odd_cpu_cycle);
 		stream.StreamPrimitive(stopped);
@@ -1186,4 +1518,7 @@ namespace CPU
 			to that does not need to be streamed.
 			The same applies to the InstrDetails struct; we always stream after an instruction has been executed. */
 	}
+
+	template void StreamState(SerializationStream&);
+	template void StreamState(Snapshot&);
 }
\ No newline at end of file
@@ -5,12 +5,29 @@ import SerializationStream;
 import Util;
 
 import <array>;
+import <string_view>;
 import <utility>;
 
 namespace CPU
 {
 	export
 	{
+		enum class AddrMode {
+			Absolute,
+			AbsoluteX,
+			AbsoluteY,
+			Accumulator,
+			Implied,
+			Immediate,
+			IndexedIndirect,
+			Indirect,
+			IndirectIndexed,
+			Relative,
+			ZeroPage,
+			ZeroPageX,
+			ZeroPageY
+		};
+
 		enum class InterruptType {
 			BRK, IRQ, NMI
 		};
@@ -26,50 +43,140 @@ namespace CPU
 			DF5 = 1 << 7
 		};
 
+		/* How opcodes are dispatched. FunctionTable makes an indirect call through 'instr_table' for every instruction.
+		   Switch executes all opcodes from a single switch statement generated from the same table, which lets the compiler
+		   inline the instruction bodies. BlockCache executes code in PRG ROM from cached, pre-decoded blocks of instructions,
+		   and falls back to the function table elsewhere. Define NES_CPU_SWITCH_DISPATCH or NES_CPU_BLOCK_CACHE to build with
+		   either of the latter. All cores are always compiled, so that they can be compared (see NESBench).
+		   There is no recompiling (JIT) core. One that translates blocks to x86-64 with inlined RAM and ROM accesses would
+		   have to keep interrupt polling, DMA and the mapper's A12 clocking cycle exact in the code it emits, and is not
+		   implemented. */
+		enum class DispatchCore {
+			FunctionTable, Switch, BlockCache
+		};
+
+#if defined(NES_CPU_SWITCH_DISPATCH)
+		constexpr DispatchCore dispatch_core = DispatchCore::Switch;
+#elif defined(NES_CPU_BLOCK_CACHE)
+		constexpr DispatchCore dispatch_core = DispatchCore::BlockCache;
+#else
+		constexpr DispatchCore dispatch_core = DispatchCore::FunctionTable;
+#endif
+
+		/* The registers, and a hash of every bus access made by the cpu since the bus trace was enabled.
+		   Used to check that two dispatch cores execute identically (see NESBench --core-diff). */
+		struct TraceState
+		{
+			u64 bus_hash;
+			u64 cycles;
+			u64 instructions;
+			u16 pc;
+			u8 a, x, y, p, sp;
+
+			bool operator==(const TraceState&) const = default;
+		};
+
+		/* If set, loops which wait for an interrupt or for PPUSTATUS to change, by repeatedly reading the same unchanging
+		   memory (e.g. LDA $2002 / BPL, or polling a RAM flag set by the NMI handler), are detected, and their iterations
+		   are skipped up to the next event of the other components (see CheckIdleLoop). Clear to execute every iteration. */
+		constexpr bool skip_idle_loops = true;
+
+		/* If set, instructions do not compute the zero and negative flags; they store the result that the flags would be
+		   derived from, and the flags are computed from it only when read (by branches, PHP, interrupts).
+		   Define NES_CPU_LAZY_FLAGS to enable; compare with NESBench --opcodes. */
+#ifdef NES_CPU_LAZY_FLAGS
+		constexpr bool lazy_flags = true;
+#else
+		constexpr bool lazy_flags = false;
+#endif
+
+		/* The default number of cycles to run the CPU for each time function Run is called. A frame is roughly 30,000 cpu cycles.
+		   To run up to a frame or scanline boundary instead, see NES::RunFrame and NES::RunUntilScanline. */
+		constexpr uint cycle_run_len = 10000;
+
+		/* Runs at least 'num_cycles' cycles, or until StopRun is called; see CPU.cpp. */
+		template<DispatchCore = dispatch_core>
+		uint Run(uint num_cycles = cycle_run_len);
+
+		void EnableBusTrace(bool enable);
+		void ExecuteOpcode(u8 opcode);
+		AddrMode GetAddrMode(u8 opcode);
+		u64 GetCycleCount();
+		u64 GetInstructionCount();
+		/* The assembler mnemonic of the instruction of 'opcode', e.g. "LDA". */
+		std::string_view GetMnemonic(u8 opcode);
+		u64 GetSkippedIdleCycles();
+		TraceState GetTraceState();
+		bool InterruptInputsAreSettled();
 		void PollInterruptInputs();
 		void PowerOn();
 		void Reset(bool jump_to_reset_vector = true);
-		void Run();
 		void RunStartUpCycles();
 		void SetIrqHigh(IrqSource source_mask);
 		void SetIrqLow(IrqSource source_mask);
 		void SetNmiHigh();
 		void SetNmiLow();
 		void Stall();
+		/* Makes the ongoing call to Run return once the current instruction has completed. */
+		void StopRun();
 		void PerformOamDmaTransfer(u8 page, u8* oam_start_ptr, u8 offset);
-		void StreamState(SerializationStream& stream);
+		template<typename Stream> void StreamState(Stream& stream);
+
+		constexpr uint GetOperandLength(AddrMode addr_mode)
+		{
+			switch (addr_mode) {
+			case AddrMode::Accumulator: case AddrMode::Implied:
+				return 0;
+			case AddrMode::Absolute: case AddrMode::AbsoluteX: case AddrMode::AbsoluteY: case AddrMode::Indirect:
+				return 2;
+			default:
+				return 1;
+			}
+		}
 	}
 
-	enum class AddrMode {
-		Absolute,
-		AbsoluteX,
-		AbsoluteY,
-		Accumulator,
-		Implied,
-		Immediate,
-		IndexedIndirect,
-		Indirect,
-		IndirectIndexed,
-		Relative,
-		ZeroPage,
-		ZeroPageX,
-		ZeroPageY
+	/* Where ExecuteInstruction takes the operand bytes following the opcode from: read through the bus,
+	   or from the current pre-decoded instruction of the block cache (see ExecuteCachedInstruction). */
+	enum class OperandSource {
+		Bus, Block
 	};
 
 	using Instruction = void(*)();
 
-	template<Instruction, AddrMode>
+	struct Block;
+	struct CachedInstruction;
+
+	template<Instruction, AddrMode, OperandSource = OperandSource::Bus>
 	void ExecuteInstruction();
 
+	template<OperandSource>
+	u8 FetchOperandCycle();
+
+	template<DispatchCore, bool traced>
+	void FetchDecodeExecuteInstruction(const CachedInstruction* cached_instr);
+
 	template<Instruction>
 	u8 GetStatusRegInstr();
 
 	template<InterruptType>
 	void ServiceInterrupt();
 
+	template<DispatchCore, bool traced>
+	void RunInstructions();
+
+	template<DispatchCore, bool traced>
+	void StepInstruction(const CachedInstruction* cached_instr);
+
 	void Branch(bool cond);
-	void FetchDecodeExecuteInstruction();
+	void CheckIdleLoop();
+	void ClearBlockCache();
+	void DecodeBlock(Block& block, const u8* page, uint offset);
+	void ExecuteInstructionSwitch(u8 opcode);
+	u8 FetchCachedOperandCycle();
+	const Block* GetBlock(u16 addr);
+	const CachedInstruction* GetCachedInstruction();
 	u8 GetStatusRegInterrupt();
+	void HashBusAccess(u16 addr, u8 data, bool write);
 	void PollInterruptOutputs();
 	u8 PullByteFromStack();
 	u16 PullWordFromStack();
@@ -77,8 +184,11 @@ namespace CPU
 	void PushWordToStack(u16 word);
 	u8 ReadCycle(u16 addr);
 	u16 ReadWord(u16 addr);
+	void RecordIdleLoopAccess(u16 addr, u8 data, bool write);
 	void SetStatusReg(u8 value);
+	void SkipIdleLoopIterations(uint iteration_cycles, uint iteration_instructions);
 	void StartCycle();
+	void TraceBusAccess(u16 addr, u8 data, bool write);
 	void WaitCycle();
 	void WriteCycle(u16 addr, u8 data);
 
@@ -165,13 +275,16 @@ namespace CPU
 	void TAS();
 	void XAA();
 
-	/* How many cycles to run the CPU for each time function Run is called. A frame is roughly 30,000 cpu cycles.
-	   Afterwards, input is polled. */
-	constexpr uint cycle_run_len = 10000;
+	struct Opcode
+	{
+		Instruction instr;
+		AddrMode addr_mode;
+		std::string_view name; /* Of the handler, e.g. "ASL_M"; the mnemonic with a suffix for some instructions. */
+	};
 
-	/* Mark this as constexpr and MSVC will freak out */
-	 std::array instr_table = {
-#define OP(INSTR, ADDR_MODE) ExecuteInstruction<INSTR, AddrMode::ADDR_MODE>
+	/* The instruction and addressing mode of each opcode. The dispatch cores and the disassembler are generated from this table. */
+	constexpr std::array<Opcode, 256> opcode_table = { {
+#define OP(INSTR, ADDR_MODE) { INSTR, AddrMode::ADDR_MODE, #INSTR }
 #define ABS Absolute
 #define ABX AbsoluteX
 #define ABY AbsoluteY
@@ -234,37 +347,142 @@ namespace CPU
 #undef ZP
 #undef ZPX
 #undef ZPY
+	} };
+
+	template<OperandSource operand_source, std::size_t... opcodes>
+	constexpr auto MakeInstrTable(std::index_sequence<opcodes...>)
+	{
+		return std::array{ ExecuteInstruction<opcode_table[opcodes].instr, opcode_table[opcodes].addr_mode, operand_source>... };
+	}
+
+	/* Mark this as constexpr and MSVC will freak out */
+	std::array instr_table = MakeInstrTable<OperandSource::Bus>(std::make_index_sequence<256>{});
+	std::array cached_instr_table = MakeInstrTable<OperandSource::Block>(std::make_index_sequence<256>{});
+
+	/* The block cache. A block is a run of instructions decoded from a single read-only (PRG ROM) page, and is tagged
+	   with the host address of its first opcode, which identifies the PRG bank as well as the cpu address.
+	   Blocks end at unconditional jumps, returns and page boundaries. Timing is unaffected: every instruction still
+	   performs all of its cycles and bus accesses, except that the opcode and operand bytes are taken from the block. */
+	struct CachedInstruction
+	{
+		Instruction handler;
+		u8 opcode;
+		u8 length;
+		std::array<u8, 2> operands;
+	};
+
+	constexpr uint block_cache_size = 1024;
+	constexpr uint max_block_length = 16;
+
+	struct Block
+	{
+		const u8* start = nullptr; /* Host address of the first opcode, or nullptr if the entry is unused. */
+		const u8* page = nullptr; /* Host address of the page that the block was decoded from. */
+		uint length = 0;
+		std::array<CachedInstruction, max_block_length> instrs;
+	};
+
+	thread_local std::array<Block, block_cache_size> block_cache;
+	thread_local const Block* current_block = nullptr;
+	thread_local const u8* cached_operand = nullptr; /* The next operand byte of the instruction being executed from a block. */
+	thread_local uint current_block_index; /* Index of the next instruction to execute in 'current_block'. */
+	thread_local u16 current_block_pc; /* The cpu address of that instruction. */
+
+	/* The iteration of a potential idle loop that is being executed; see CheckIdleLoop. */
+	constexpr uint max_idle_loop_accesses = 32;
+
+	struct BusAccess
+	{
+		u16 addr;
+		u8 data;
 	};
 
-	bool bit_to_write_to_irq_disable_flag;
-	bool need_irq;
-	bool need_nmi; // Whether we need to service an NMI interrupt. Is set right after a negative edge is detected (prev_polled_NMI_line == 1 && polled_NMI_line == 0)
-	bool nmi_line; // The NMI signal coming from the ppu.
-	bool odd_cpu_cycle; // if the current cpu cycle is odd_numbered
-	bool page_crossed;
-	bool polled_need_irq;
-	bool polled_need_nmi; // Same as above, but this only gets updated to 'need_NMI' only cycle after need_NMI is updated. If this is set after we have executed an instruction, we service the NMI.
-	bool polled_nmi_line; // The polled NMI line signal during the 2nd half of the last and second to last CPU cycle, respectively.
-	bool prev_polled_nmi_line;
-	bool stopped; // set to true by the STP instruction
-	bool write_to_irq_disable_flag_before_next_instr;
+	thread_local struct IdleLoop
+	{
+		std::array<BusAccess, max_idle_loop_accesses> accesses; /* All reads made during the iteration; there are no writes. */
+		uint num_accesses;
+		u64 start_cycle;
+		u64 start_instruction;
+		u16 head; /* The address jumped back to. */
+		u8 a, x, y, p, sp; /* The registers at the start of the iteration. */
+		bool reads_ppustatus;
+		bool recording; /* Cleared as soon as the iteration is found not to be idle. */
+	} idle_loop;
+
+	thread_local bool bit_to_write_to_irq_disable_flag;
+	thread_local bool bus_trace_enabled = false;
+	thread_local bool need_irq;
+	thread_local bool need_nmi; // Whether we need to service an NMI interrupt. Is set right after a negative edge is detected (prev_polled_NMI_line == 1 && polled_NMI_line == 0)
+	thread_local bool nmi_line; // The NMI signal coming from the ppu.
+	thread_local bool odd_cpu_cycle; // if the current cpu cycle is odd_numbered
+	thread_local bool page_crossed;
+	thread_local bool polled_need_irq;
+	thread_local bool polled_need_nmi; // Same as above, but this only gets updated to 'need_NMI' only cycle after need_NMI is updated. If this is set after we have executed an instruction, we service the NMI.
+	thread_local bool polled_nmi_line; // The polled NMI line signal during the 2nd half of the last and second to last CPU cycle, respectively.
+	thread_local bool prev_polled_nmi_line;
+	thread_local bool stopped; // set to true by the STP instruction
+	thread_local bool write_to_irq_disable_flag_before_next_instr;
 
 	/* general-purpose registers */
-	u8 A, X, Y;
+	thread_local u8 A, X, Y;
 	/* One bit for each IRQ source (there are eight; https://wiki.nesdev.org/w/index.php?title=IRQ). */
-	u8 irq_line;
-	u8 opcode;
-	u8 operand;
-	u8 read_addr;
+	thread_local u8 irq_line;
+	thread_local u8 opcode;
+	thread_local u8 operand;
+	thread_local u8 read_addr;
 	/* stack pointer */
-	u8 sp;
+	thread_local u8 sp;
 
-	u16 addr;
+	thread_local u16 addr;
 	/* program counter */
-	u16 pc;
+	thread_local u16 pc;
 
-	struct Status
+	thread_local struct Status
 	{
+		bool Neg() const
+		{
+			if constexpr (lazy_flags) {
+				return nz_result & 0x180;
+			}
+			else {
+				return neg;
+			}
+		}
+
+		bool Zero() const
+		{
+			if constexpr (lazy_flags) {
+				return (nz_result & 0xFF) == 0;
+			}
+			else {
+				return zero;
+			}
+		}
+
+		/* Sets the zero and negative flags from the result of an instruction. */
+		void SetNZ(u8 result)
+		{
+			if constexpr (lazy_flags) {
+				nz_result = result;
+			}
+			else {
+				zero = result == 0;
+				neg = result & 0x80;
+			}
+		}
+
+		void SetZeroAndNeg(bool new_zero, bool new_neg)
+		{
+			if constexpr (lazy_flags) {
+				/* Bit 8 stands in for bit 7, so that both flags can be set at once. */
+				nz_result = !new_zero | new_neg << 8;
+			}
+			else {
+				zero = new_zero;
+				neg = new_neg;
+			}
+		}
+
 		bool carry;
 		bool zero;
 		bool irq_disable;
@@ -272,20 +490,29 @@ namespace CPU
 		bool b; /* The B flag; no CPU effect. Actually two bits (this is the lower one). Reads either 10 or 11 in different situations. */
 		bool overflow;
 		bool neg;
+		u16 nz_result; /* With lazy flags: zero if the low byte is 0, negative if bit 7 or 8 is set. Replaces 'zero' and 'neg'. */
 	} status{};
 
 	/* Cycles elapsed during the current call to Update(). */
-	uint cpu_cycle_counter;
+	thread_local uint cpu_cycle_counter;
+	/* The length of the current call to Run; lowered by StopRun. */
+	thread_local uint cycles_to_run;
 	/* Writes to certain PPU registers are ignored earlier than ~29658 CPU clocks after reset (on NTSC) */
-	uint cpu_cycles_since_reset = 0;
-	uint cpu_cycles_until_all_ppu_regs_writable = 29658;
+	thread_local uint cpu_cycles_since_reset = 0;
+	thread_local uint cpu_cycles_until_all_ppu_regs_writable = 29658;
 	/* refers to stalling done by the APU when the DMC memory reader reads a byte from PRG */
-	uint cpu_cycles_until_no_longer_stalled;
-	/* Cycles elapsed since the game was started. */
-	uint total_cpu_cycle_counter = 0;
+	thread_local uint cpu_cycles_until_no_longer_stalled;
+	/* Cycles elapsed since the game was started, excluding the ongoing call to Run. */
+	thread_local u64 total_cpu_cycle_counter = 0;
+	/* Instructions executed since the game was started. */
+	thread_local u64 instruction_counter = 0;
+	/* FNV-1a hash of the bus accesses made while 'bus_trace_enabled' is set. */
+	thread_local u64 bus_trace_hash;
+	/* Cpu cycles not executed by the cpu because they were spent in an idle loop. */
+	thread_local u64 skipped_idle_cycles = 0;
 
 	/// Template definitions ////////////////////////////////////////
-	template<Instruction instr, AddrMode addr_mode>
+	template<Instruction instr, AddrMode addr_mode, OperandSource operand_source>
 	void ExecuteInstruction()
 	{
 		using enum AddrMode;
@@ -296,23 +523,23 @@ namespace CPU
 			ReadCycle(pc); /* Dummy read */
 		}
 		else if constexpr (addr_mode == Immediate) {
-			read_addr = ReadCycle(pc++);
+			read_addr = FetchOperandCycle<operand_source>();
 		}
 		else if constexpr (addr_mode == ZeroPage || addr_mode == Relative) {
-			addr = ReadCycle(pc++);
+			addr = FetchOperandCycle<operand_source>();
 		}
 		else if constexpr (addr_mode == ZeroPageX || addr_mode == ZeroPageY) {
 			u8 index = [&] {
 				if constexpr (addr_mode == ZeroPageX) return X;
 				else return Y;
 			}();
-			addr = ReadCycle(pc++);
+			addr = FetchOperandCycle<operand_source>();
 			ReadCycle(addr); /* Dummy read */
 			addr = (addr + index) & 0xFF;
 		}
 		else if constexpr (addr_mode == Absolute) {
-			u8 addr_lo = ReadCycle(pc++);
-			u8 addr_hi = ReadCycle(pc++);
+			u8 addr_lo = FetchOperandCycle<operand_source>();
+			u8 addr_hi = FetchOperandCycle<operand_source>();
 			addr = addr_hi << 8 | addr_lo;
 		}
 		else if constexpr (addr_mode == AbsoluteX || addr_mode == AbsoluteY) {
@@ -320,8 +547,8 @@ namespace CPU
 				if constexpr (addr_mode == AbsoluteX) return X;
 				else return Y;
 			}();
-			u8 addr_lo = ReadCycle(pc++);
-			u8 addr_hi = ReadCycle(pc++);
+			u8 addr_lo = FetchOperandCycle<operand_source>();
+			u8 addr_hi = FetchOperandCycle<operand_source>();
 			page_crossed = addr_lo + index > 0xFF;
 			addr_lo += index;
 			addr = addr_hi << 8 | addr_lo;
@@ -329,8 +556,8 @@ namespace CPU
 			addr += page_crossed << 8; /* Potentially add 1 to the upper address byte */
 		}
 		else if constexpr (addr_mode == Indirect) {
-			u8 addr_lo = ReadCycle(pc++);
-			u8 addr_hi = ReadCycle(pc++);
+			u8 addr_lo = FetchOperandCycle<operand_source>();
+			u8 addr_hi = FetchOperandCycle<operand_source>();
 			addr = addr_hi << 8 | addr_lo;
 			u16 addr_tmp = ReadCycle(addr);
 			// HW bug: if 'addr' is xyFF, then the upper byte of 'addr_tmp' is fetched from xy00, not (xy+1)00
@@ -345,7 +572,7 @@ namespace CPU
 			addr = addr_tmp;
 		}
 		else if constexpr (addr_mode == IndexedIndirect) {
-			u8 addr_lo = ReadCycle(pc++);
+			u8 addr_lo = FetchOperandCycle<operand_source>();
 			ReadCycle(addr_lo); /* Dummy read */
 			addr_lo += X;
 			read_addr = ReadCycle(addr_lo);
@@ -354,7 +581,7 @@ namespace CPU
 			addr = addr_hi << 8 | read_addr;
 		}
 		else if constexpr (addr_mode == IndirectIndexed) {
-			u8 addr_lo = ReadCycle(pc++);
+			u8 addr_lo = FetchOperandCycle<operand_source>();
 			read_addr = ReadCycle(addr_lo);
 			++addr_lo;
 			u8 addr_hi = ReadCycle(addr_lo);
@@ -397,4 +624,16 @@ namespace CPU
 
 		instr();
 	}
+
+
+	template<OperandSource operand_source>
+	u8 FetchOperandCycle()
+	{
+		if constexpr (operand_source == OperandSource::Bus) {
+			return ReadCycle(pc++);
+		}
+		else {
+			return FetchCachedOperandCycle();
+		}
+	}
 }
\ No newline at end of file
@@ -1,15 +1,8 @@
 module Cartridge;
 
-import AxROM;
-import CNROM;
-import Mapper094;
-import Mapper180;
-import MapperProperties;
-import MMC1;
-import MMC3;
-import NROM;
+import Bus;
+import Snapshot;
 import System;
-import UxROM;
 
 import Util.Files;
 
@@ -17,9 +10,51 @@ import UserMessage;
 
 namespace Cartridge
 {
+	u32 Crc32(std::span<const u8> data)
+	{
+		/* The common CRC-32 (reflected polynomial 0xEDB88320), as listed for roms by e.g. No-Intro. */
+		static constexpr std::array<u32, 256> table = [] {
+			std::array<u32, 256> table{};
+			for (u32 i = 0; i < 256; ++i) {
+				u32 crc = i;
+				for (int bit = 0; bit < 8; ++bit) {
+					crc = crc & 1 ? crc >> 1 ^ 0xEDB88320 : crc >> 1;
+				}
+				table[i] = crc;
+			}
+			return table;
+		}();
+		u32 crc = 0xFFFFFFFF;
+		for (u8 byte : data) {
+			crc = table[(crc ^ byte) & 0xFF] ^ crc >> 8;
+		}
+		return ~crc;
+	}
+
+
 	void Eject()
 	{
-		mapper.release();
+		Bus::UnmapPages(0x4000, 0xC000);
+		concrete_mapper = {};
+		mapper.reset();
+	}
+
+
+	uint GetCpuCyclesUntilNextEvent()
+	{
+		return mapper->GetCpuCyclesUntilNextEvent();
+	}
+
+
+	std::span<const u8> GetPrgRom()
+	{
+		return mapper != nullptr ? mapper->GetPrgRom() : std::span<const u8>{};
+	}
+
+
+	u32 GetRomCrc()
+	{
+		return rom_crc;
 	}
 
 
@@ -57,23 +92,29 @@ namespace Cartridge
 		while (index++ < prg_rom_start) {
 			rom.erase(rom.begin());
 		}
-		/* Construct a mapper. */
-#define MAKE_MAPPER(MAPPER) std::make_unique<MAPPER>(rom, mapper_properties)
+		/* Construct a mapper. The pages of the previous one are unmapped first, as it is destroyed. */
+		Bus::UnmapPages(0x4000, 0xC000);
+#define MAKE_MAPPER(MAPPER) MakeMapper<MAPPER>(rom, mapper_properties)
 		switch (mapper_properties.mapper_num) {
-		case   0: mapper = MAKE_MAPPER(NROM); break;
-		case   1: mapper = MAKE_MAPPER(MMC1); break;
-		case   2: mapper = MAKE_MAPPER(UxROM); break;
-		case   3: mapper = MAKE_MAPPER(CNROM); break;
-		case   4: mapper = MAKE_MAPPER(MMC3); break;
-		case   7: mapper = MAKE_MAPPER(AxROM); break;
-		case  94: mapper = MAKE_MAPPER(Mapper094); break;
-		case 180: mapper = MAKE_MAPPER(Mapper180); break;
+		case   0: MAKE_MAPPER(NROM); break;
+		case   1: MAKE_MAPPER(MMC1); break;
+		case   2: MAKE_MAPPER(UxROM); break;
+		case   3: MAKE_MAPPER(CNROM); break;
+		case   4: MAKE_MAPPER(MMC3); break;
+		case   7: MAKE_MAPPER(AxROM); break;
+		case  94: MAKE_MAPPER(Mapper094); break;
+		case 180: MAKE_MAPPER(Mapper180); break;
 		default:
 			UserMessage::Show(std::format("Unsupported mapper number {} detected.", mapper_properties.mapper_num), UserMessage::Type::Error);
 		}
 #undef MAKE_MAPPER
 
-		return mapper != nullptr;
+		if (mapper == nullptr) {
+			return false;
+		}
+		mapper->MapPRG();
+		rom_crc = Crc32(opt_rom.value());
+		return true;
 	}
 
 
@@ -188,11 +229,17 @@ namespace Cartridge
 	}
 
 
-	void StreamState(SerializationStream& stream)
+	template<typename Stream>
+	void StreamState(Stream& stream)
 	{
 		mapper->StreamState(stream);
+		/* Loading a state may have switched PRG banks. */
+		mapper->MapPRG();
 	}
 
+	template void StreamState(SerializationStream&);
+	template void StreamState(Snapshot&);
+
 
 	void ClockIRQ()
 	{
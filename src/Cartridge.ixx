@@ -1,7 +1,15 @@
 export module Cartridge;
 
+import AxROM;
 import BaseMapper;
+import CNROM;
+import Mapper094;
+import Mapper180;
 import MapperProperties;
+import MMC1;
+import MMC3;
+import NROM;
+import UxROM;
 
 import NumericalTypes;
 import SerializationStream;
@@ -11,7 +19,9 @@ import <array>;
 import <format>;
 import <memory>;
 import <optional>;
+import <span>;
 import <string>;
+import <variant>;
 import <vector>;
 
 class BaseMapper;
@@ -22,16 +32,39 @@ namespace Cartridge
 	{
 		void ClockIRQ();
 		void Eject();
+		uint GetCpuCyclesUntilNextEvent();
+		std::span<const u8> GetPrgRom();
+		/* CRC-32 of the whole rom file that was loaded, including its header, and thus the mapper. Identifies the rom that a
+		   saved state belongs to (see Snapshot). */
+		u32 GetRomCrc();
 		bool LoadRom(const std::string& path);
 		u8 ReadNametableRAM(u16 addr);
 		u8 ReadCHR(u16 addr);
 		u8 ReadPRG(u16 addr);
 		void ReadPRGRAMFromDisk();
-		void StreamState(SerializationStream& stream);
+		template<typename Stream> void StreamState(Stream& stream);
 		void WriteCHR(u16 addr, u8 data);
 		void WriteNametableRAM(u16 addr, u8 data);
 		void WritePRG(u16 addr, u8 data);
 		void WritePRGRAMToDisk();
+
+		/* Calls 'func' with a reference to the current mapper as its concrete type. Code that runs for many cycles in a row
+		   (e.g. the PPU catching up with the cpu) can visit once, and then use the templated accessors below,
+		   which make direct (inlinable) calls instead of virtual ones. */
+		template<typename Func>
+		decltype(auto) VisitMapper(Func&& func);
+
+		template<typename Mapper>
+		void ClockIRQ();
+
+		template<typename Mapper>
+		u8 ReadCHR(u16 addr);
+
+		template<typename Mapper>
+		u16 ReadCHRRow(u16 addr);
+
+		template<typename Mapper>
+		u8 ReadNametableRAM(u16 addr);
 	}
 
 	/* The header will specify the rom size in units of the below. */
@@ -42,10 +75,62 @@ namespace Cartridge
 
 	using Header = std::array<u8, header_size>;
 
+	u32 Crc32(std::span<const u8> data);
 	bool ParseHeader(const Header& header, MapperProperties& properties);
 	void ParseFirstEightBytesOfHeader(const Header& header, MapperProperties& properties);
 	void ParseiNESHeader(const Header& header, MapperProperties& properties);
 	void ParseNES20Header(const Header& header, MapperProperties& properties);
 
-	std::unique_ptr<BaseMapper> mapper;
+	template<typename Mapper>
+	void MakeMapper(const std::vector<u8>& rom, const MapperProperties& properties);
+
+	thread_local u32 rom_crc;
+
+	thread_local std::unique_ptr<BaseMapper> mapper;
+	/* The same mapper as 'mapper', as a pointer to its concrete type. */
+	thread_local std::variant<AxROM*, CNROM*, Mapper094*, Mapper180*, MMC1*, MMC3*, NROM*, UxROM*> concrete_mapper;
+
+	/// Template definitions ////////////////////////////////////////
+	template<typename Func>
+	decltype(auto) VisitMapper(Func&& func)
+	{
+		return std::visit([&](auto* concrete) -> decltype(auto) { return func(*concrete); }, concrete_mapper);
+	}
+
+
+	template<typename Mapper>
+	void ClockIRQ()
+	{
+		static_cast<Mapper&>(*mapper).Mapper::ClockIRQ();
+	}
+
+
+	template<typename Mapper>
+	void MakeMapper(const std::vector<u8>& rom, const MapperProperties& properties)
+	{
+		auto new_mapper = std::make_unique<Mapper>(rom, properties);
+		concrete_mapper = new_mapper.get();
+		mapper = std::move(new_mapper);
+	}
+
+
+	template<typename Mapper>
+	u8 ReadCHR(u16 addr)
+	{
+		return static_cast<Mapper&>(*mapper).Mapper::ReadCHR(addr);
+	}
+
+
+	template<typename Mapper>
+	u16 ReadCHRRow(u16 addr)
+	{
+		return static_cast<Mapper&>(*mapper).template ReadCHRRow<Mapper>(addr);
+	}
+
+
+	template<typename Mapper>
+	u8 ReadNametableRAM(u16 addr)
+	{
+		return static_cast<Mapper&>(*mapper).template ReadNametableRAM<Mapper>(addr);
+	}
 }
\ No newline at end of file
@@ -1,9 +1,12 @@
 export module Debug;
 
 import CPU;
+import TraceFile;
 
 import NumericalTypes;
 
+import <algorithm>;
+import <array>;
 import <cassert>;
 import <format>;
 import <fstream>;
@@ -15,23 +18,110 @@ namespace Debug
 {
 	export
 	{
+		/* The state of the cpu at the start of an instruction, after its opcode has been fetched. */
+		struct InstrTrace
+		{
+			u64 cycle; /* Cpu cycles elapsed before the opcode fetch. */
+			u16 pc;
+			u8 opcode;
+			u8 a, x, y, p, sp;
+		};
+
+		/* Receives the events of the console running on the current thread, while attached through AttachTracer.
+		   The cpu runs a separate instantiation of its instruction loop while a tracer is attached (see CPU::Run), so that
+		   tracing costs nothing otherwise; only the (comparatively rare) I/O register accesses and OAM DMA check for a tracer. */
+		class Tracer
+		{
+		public:
+			virtual ~Tracer() = default;
+			virtual void OnDma(u16 src_addr) {}
+			virtual void OnInstruction(const InstrTrace& instr) {}
+			/* 'cycle' is the number of cpu cycles elapsed before the interrupt sequence. */
+			virtual void OnInterrupt(CPU::InterruptType interrupt, u64 cycle) {}
+			virtual void OnIoRead(u16 addr, u8 value) {}
+			virtual void OnIoWrite(u16 addr, u8 value) {}
+		};
+
+		/* Any number of tracers can be attached at once (e.g. the profiler while a trace is recorded); each one receives every
+		   event, in the order in which they were attached. Attaching a tracer that is already attached has no effect. */
+		void AttachTracer(Tracer* tracer);
+		void DetachTracer(Tracer* tracer);
+		bool IsTracerAttached(const Tracer* tracer);
+		/* Disassembles the instruction at 'pc' in the current memory map. Instructions in PRG ROM are cached per bank and
+		   address, so that e.g. a debugger view of the code around pc is cheap to refresh every frame. */
 		std::string Disassemble(u16 pc);
 		std::vector<std::string> Disassemble(u16 pc, size_t num_instructions);
-		void LogDma(u16 src_addr);
-		void LogInstr(u8 opcode, u8 A, u8 X, u8 Y, u8 P, u8 S, u16 PC);
-		void LogInterrupt(CPU::InterruptType interrupt);
-		void LogIoRead(u16 addr, u8 value);
-		void LogIoWrite(u16 addr, u8 value);
+		/* Disassembles an instruction from its bytes; 'operands' beyond the length of the instruction are ignored. */
+		std::string Disassemble(u16 pc, u8 opcode, std::array<u8, 2> operands);
+		/* Formats an instruction like a line of the nestest log, without the PPU position, and without the memory values
+		   at the operand address. */
+		std::string FormatTraceLine(const InstrTrace& instr, std::array<u8, 2> operands, std::string_view disassembly);
+		bool SaveTraceRecording(const std::string& path);
 		void SetLogPath(const std::string& path);
+		/* Records every instruction (and, if 'record_io', I/O register accesses, interrupts and OAM DMA) as a binary record
+		   into a ring holding the last 'capacity' of them; see TraceFile. If 'path' is empty, the ring is in memory and can
+		   be written out with SaveTraceRecording, otherwise it is mapped onto the file at 'path'. */
+		bool StartTraceRecording(size_t capacity, const std::string& path = {}, bool record_io = true);
+		void StopTraceRecording();
 
-		constexpr bool logging_enabled = true;
-		constexpr bool log_instr = logging_enabled && true;
-		constexpr bool log_dma = logging_enabled && true;
-		constexpr bool log_interrupts = logging_enabled && true;
-		constexpr bool log_io = logging_enabled && true;
+		/* The attached tracer, or 'tracer_tee' if there are several; set through AttachTracer and DetachTracer. */
+		thread_local Tracer* tracer = nullptr;
 	}
 
-	bool logging_disabled = true;
+	/* A disassembled instruction in a read-only page (PRG ROM), tagged with the host address of its opcode, which
+	   identifies the bank, and its cpu address, on which the text of relative branches depends. */
+	struct DisassembledInstruction
+	{
+		const u8* host_addr = nullptr;
+		u16 pc;
+		std::string text;
+	};
+
+	constexpr uint disassembly_cache_size = 4096;
+
+	/* Passes every event on to each of the attached tracers, while there are several. */
+	class TracerTee : public Tracer
+	{
+	public:
+		void OnDma(u16 src_addr) override;
+		void OnInstruction(const InstrTrace& instr) override;
+		void OnInterrupt(CPU::InterruptType interrupt, u64 cycle) override;
+		void OnIoRead(u16 addr, u8 value) override;
+		void OnIoWrite(u16 addr, u8 value) override;
+
+		std::vector<Tracer*> tracers; /* All attached tracers, in the order in which they were attached. */
+	};
+
+	/* Writes every event as a line of text to the file opened with SetLogPath. */
+	class TextLogger : public Tracer
+	{
+	public:
+		void OnDma(u16 src_addr) override;
+		void OnInstruction(const InstrTrace& instr) override;
+		void OnInterrupt(CPU::InterruptType interrupt, u64 cycle) override;
+		void OnIoRead(u16 addr, u8 value) override;
+		void OnIoWrite(u16 addr, u8 value) override;
+
+		std::ofstream log;
+	};
+
+	/* Pushes every event to a TraceFile::Buffer. */
+	class TraceRecorder : public Tracer
+	{
+	public:
+		void OnDma(u16 src_addr) override;
+		void OnInstruction(const InstrTrace& instr) override;
+		void OnInterrupt(CPU::InterruptType interrupt, u64 cycle) override;
+		void OnIoRead(u16 addr, u8 value) override;
+		void OnIoWrite(u16 addr, u8 value) override;
+
+		TraceFile::Buffer buffer;
+		bool record_io = true;
+		u64 cycle = 0; /* Of the last instruction or interrupt; I/O accesses and DMA are recorded with it. */
+	};
 
-	std::ofstream log;
+	thread_local std::array<DisassembledInstruction, disassembly_cache_size> disassembly_cache;
+	thread_local TextLogger text_logger;
+	thread_local TraceRecorder trace_recorder;
+	thread_local TracerTee tracer_tee;
 }
\ No newline at end of file
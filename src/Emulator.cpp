@@ -0,0 +1,124 @@
+module Emulator;
+
+import APU;
+import Bus;
+import Cartridge;
+import CPU;
+import NES;
+import PPU;
+
+Emulator::Emulator()
+	: worker{ [this](std::stop_token stop_token) { ProcessJobs(stop_token); } }
+{
+}
+
+
+Emulator::~Emulator()
+{
+	Execute([] { Cartridge::Eject(); }).wait();
+}
+
+
+u64 Emulator::GetCycleCount()
+{
+	return Execute([] { return CPU::GetCycleCount(); }).get();
+}
+
+
+std::vector<u8> Emulator::GetFramebuffer()
+{
+	return Execute([] { return PPU::GetFramebuffer(); }).get();
+}
+
+
+u64 Emulator::GetFrameCount()
+{
+	return Execute([] { return PPU::GetFrameCount(); }).get();
+}
+
+
+bool Emulator::LoadRom(const std::string& path)
+{
+	return Execute([&path] {
+		if (!NES::LoadRom(path)) {
+			return false;
+		}
+		NES::Initialize();
+		return true;
+	}).get();
+}
+
+
+void Emulator::NotifyButtonPressed(uint player_index, uint button_index)
+{
+	Execute([=] { NES::NotifyButtonPressed(player_index, button_index); }).wait();
+}
+
+
+void Emulator::NotifyButtonReleased(uint player_index, uint button_index)
+{
+	Execute([=] { NES::NotifyButtonReleased(player_index, button_index); }).wait();
+}
+
+
+u8 Emulator::PeekMemory(u16 addr)
+{
+	return Execute([=] { return Bus::Peek(addr); }).get();
+}
+
+
+void Emulator::ProcessJobs(std::stop_token stop_token)
+{
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock lock{ mutex };
+			if (!job_available.wait(lock, stop_token, [this] { return !jobs.empty(); })) {
+				return; /* stop requested, and no jobs are left */
+			}
+			job = std::move(jobs.front());
+			jobs.pop();
+		}
+		job();
+	}
+}
+
+
+void Emulator::Reset()
+{
+	Execute([] { NES::Reset(); }).wait();
+}
+
+
+void Emulator::RunFrames(uint num_frames)
+{
+	RunFramesAsync(num_frames).wait();
+}
+
+
+std::future<void> Emulator::RunFramesAsync(uint num_frames)
+{
+	return Execute([num_frames] {
+		for (uint i = 0; i < num_frames; ++i) {
+			NES::RunFrame();
+		}
+	});
+}
+
+
+void Emulator::SetAudioOutput(std::function<void(f32)> output, uint sample_rate)
+{
+	Execute([&output, sample_rate] { APU::SetSampleOutput(std::move(output), sample_rate); }).wait();
+}
+
+
+void Emulator::SetVideoOutput(std::function<void(std::span<const u8>)> output)
+{
+	Execute([&output] { PPU::SetFrameOutput(std::move(output)); }).wait();
+}
+
+
+void Emulator::StreamState(SerializationStream& stream)
+{
+	Execute([&stream] { NES::StreamState(stream); }).wait();
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+export module Emulator;
+
+import NumericalTypes;
+import SerializationStream;
+
+import <condition_variable>;
+import <functional>;
+import <future>;
+import <memory>;
+import <mutex>;
+import <queue>;
+import <span>;
+import <stop_token>;
+import <string>;
+import <thread>;
+import <type_traits>;
+import <utility>;
+import <vector>;
+
+/* An independent console instance. The state of every component is kept in thread_local variables, so an Emulator owns a
+   worker thread, and everything that touches the console is executed on it. Any number of instances can thus run in parallel
+   within the same process, typically one per host core. The member functions block until the worker has carried out the
+   request, apart from RunFramesAsync and Execute, which return a future.
+   Limitation: a thread runs at most one console. The console of an instance is that of its worker thread, so an instance
+   cannot be moved to another thread, nor share one with another instance; likewise, the console driven directly through
+   the NES namespace (e.g. by the frontend) is that of the calling thread, and is unrelated to any instance.
+   The Video and Audio modules are shared by the whole process. Give each instance its own outputs through SetVideoOutput
+   and SetAudioOutput when running several; otherwise, their frames and samples all end up in the Video and Audio modules.
+   The component state is thread_local, rather than moved into a struct per instance reached through a context pointer, so
+   that the components keep their namespace-level functions and state. Some of it is not trivial to construct or destroy
+   (e.g. the framebuffer vectors and the mapper), so an access to it may go through a TLS init wrapper. Measured with
+   NESBench on a single instance, this costs about 2% over the namespace-global state it replaced. */
+export class Emulator
+{
+public:
+	Emulator();
+	~Emulator();
+	Emulator(const Emulator&) = delete;
+	Emulator& operator=(const Emulator&) = delete;
+
+	u64 GetCycleCount();
+	std::vector<u8> GetFramebuffer();
+	u64 GetFrameCount();
+	bool LoadRom(const std::string& path);
+	void NotifyButtonPressed(uint player_index, uint button_index);
+	void NotifyButtonReleased(uint player_index, uint button_index);
+	u8 PeekMemory(u16 addr);
+	void Reset();
+	void RunFrames(uint num_frames);
+	std::future<void> RunFramesAsync(uint num_frames);
+	/* The outputs are called on the worker thread. See APU::SetSampleOutput and PPU::SetFrameOutput. */
+	void SetAudioOutput(std::function<void(f32)> output, uint sample_rate);
+	void SetVideoOutput(std::function<void(std::span<const u8>)> output);
+	void StreamState(SerializationStream& stream);
+
+	/* Runs an arbitrary function on the worker thread of this instance, where the component namespaces (CPU, PPU, Bus etc.)
+	   refer to this console. */
+	template<typename Func>
+	std::future<std::invoke_result_t<Func>> Execute(Func&& func)
+	{
+		using Result = std::invoke_result_t<Func>;
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+		std::future<Result> future = task->get_future();
+		{
+			std::scoped_lock lock{ mutex };
+			jobs.emplace([task] { (*task)(); });
+		}
+		job_available.notify_one();
+		return future;
+	}
+
+private:
+	void ProcessJobs(std::stop_token stop_token);
+
+	std::condition_variable_any job_available;
+	std::mutex mutex;
+	std::queue<std::function<void()>> jobs;
+	std::jthread worker; /* Declared last, so that it is stopped and joined before the other members are destroyed. */
+};
\ No newline at end of file
@@ -0,0 +1,82 @@
+module FrameConversion;
+
+import <bit>;
+import <cstring>;
+
+namespace FrameConversion
+{
+	void Convert(std::span<const u8> pixels, std::span<const Emphasis> scanline_emphasis, Video::PixelFormat format, u8* out)
+	{
+		switch (format) {
+		case Video::PixelFormat::RGB888: ConvertTo<Video::PixelFormat::RGB888>(pixels, scanline_emphasis, out); break;
+		case Video::PixelFormat::RGBA8888: ConvertTo<Video::PixelFormat::RGBA8888>(pixels, scanline_emphasis, out); break;
+		case Video::PixelFormat::BGRA8888: ConvertTo<Video::PixelFormat::BGRA8888>(pixels, scanline_emphasis, out); break;
+		case Video::PixelFormat::RGB565: ConvertTo<Video::PixelFormat::RGB565>(pixels, scanline_emphasis, out); break;
+		}
+	}
+
+
+	template<Video::PixelFormat format>
+	void ConvertTo(std::span<const u8> pixels, std::span<const Emphasis> scanline_emphasis, u8* out)
+	{
+		/* One lookup per pixel, of all of its bytes at once; the copies are of a size known at compile time, so they compile
+		   to single stores. */
+		static constexpr ColourTable table = MakeColourTable<format>();
+		static constexpr uint bytes_per_pixel = format == Video::PixelFormat::RGB888 ? 3 : format == Video::PixelFormat::RGB565 ? 2 : 4;
+		const std::size_t pixels_per_scanline = pixels.size() / scanline_emphasis.size();
+		const u8* pixel = pixels.data();
+		for (Emphasis emphasis : scanline_emphasis) {
+			const std::array<PixelBytes, 64>& colours = table[emphasis & 7];
+			for (std::size_t x = 0; x < pixels_per_scanline; ++x) {
+				std::memcpy(out, colours[*pixel++ & 0x3F].data(), bytes_per_pixel);
+				out += bytes_per_pixel;
+			}
+		}
+	}
+
+
+	uint GetBytesPerPixel(Video::PixelFormat format)
+	{
+		switch (format) {
+		case Video::PixelFormat::RGB888: return 3;
+		case Video::PixelFormat::RGB565: return 2;
+		default: return 4;
+		}
+	}
+
+
+	template<Video::PixelFormat format>
+	constexpr ColourTable MakeColourTable()
+	{
+		/* Every emphasis bit attenuates the two other channels to about 82 %. */
+		auto attenuate = [](u8 channel, Emphasis emphasis, int channel_bit) {
+			int value = channel;
+			for (int bit = 0; bit < 3; ++bit) {
+				if (bit != channel_bit && (emphasis >> bit & 1)) {
+					value = value * 209 / 256;
+				}
+			}
+			return u8(value);
+		};
+		ColourTable table{};
+		for (Emphasis emphasis = 0; emphasis < 8; ++emphasis) {
+			for (uint i = 0; i < 64; ++i) {
+				const u8 r = attenuate(palette[i].r, emphasis, 0);
+				const u8 g = attenuate(palette[i].g, emphasis, 1);
+				const u8 b = attenuate(palette[i].b, emphasis, 2);
+				PixelBytes& bytes = table[emphasis][i];
+				if constexpr (format == Video::PixelFormat::RGB888 || format == Video::PixelFormat::RGBA8888) {
+					bytes = { r, g, b, 0xFF };
+				}
+				else if constexpr (format == Video::PixelFormat::BGRA8888) {
+					bytes = { b, g, r, 0xFF };
+				}
+				else {
+					const auto rgb565 = std::bit_cast<std::array<u8, 2>>(u16((r >> 3) << 11 | (g >> 2) << 5 | b >> 3));
+					bytes = { rgb565[0], rgb565[1], 0, 0 };
+				}
+			}
+		}
+		return table;
+	}
+}
\ No newline at end of file
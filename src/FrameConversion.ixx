@@ -0,0 +1,50 @@
+export module FrameConversion;
+
+import NumericalTypes;
+import Video;
+
+import <array>;
+import <span>;
+
+/* The PPU outputs a picture as one byte per pixel, the colour (0-63) read from palette RAM, and the colour emphasis bits
+   of PPUMASK once per scanline (as of its first pixel). This converts such a picture into one of the pixel formats of the
+   Video module, with the 2C02 palette from https://wiki.nesdev.org/w/index.php?title=PPU_palettes#2C02. The PPU only does
+   so for frames that are presented or read back (see PPU::GetFramebuffer), so that frames run without video output, and
+   the writes of the PPU itself, stay a third of the size of 24-bit RGB. */
+namespace FrameConversion
+{
+	export
+	{
+		/* Bit 0: emphasize red, bit 1: emphasize green, bit 2: emphasize blue, regardless of the TV standard. */
+		using Emphasis = u8;
+
+		void Convert(std::span<const u8> pixels, std::span<const Emphasis> scanline_emphasis, Video::PixelFormat format, u8* out);
+		uint GetBytesPerPixel(Video::PixelFormat format);
+	}
+
+	struct RGB
+	{
+		u8 r, g, b;
+	};
+
+	/* The bytes of a colour in a pixel format, in memory order; only the first GetBytesPerPixel are used. */
+	using PixelBytes = std::array<u8, 4>;
+	using ColourTable = std::array<std::array<PixelBytes, 64>, 8>; /* Indexed by Emphasis, then by colour. */
+
+	template<Video::PixelFormat format>
+	void ConvertTo(std::span<const u8> pixels, std::span<const Emphasis> scanline_emphasis, u8* out);
+
+	template<Video::PixelFormat format>
+	constexpr ColourTable MakeColourTable();
+
+	constexpr std::array<RGB, 64> palette = { {
+		{ 84,  84,  84}, {  0,  30, 116}, {  8,  16, 144}, { 48,   0, 136}, { 68,   0, 100}, { 92,   0,  48}, { 84,   4,   0}, { 60,  24,   0},
+		{ 32,  42,   0}, {  8,  58,   0}, {  0,  64,   0}, {  0,  60,   0}, {  0,  50,  60}, {  0,   0,   0}, {  0,   0,   0}, {  0,   0,   0},
+		{152, 150, 152}, {  8,  76, 196}, { 48,  50, 236}, { 92,  30, 228}, {136,  20, 176}, {160,  20, 100}, {152,  34,  32}, {120,  60,   0},
+		{ 84,  90,   0}, { 40, 114,   0}, {  8, 124,   0}, {  0, 118,  40}, {  0, 102, 120}, {  0,   0,   0}, {  0,   0,   0}, {  0,   0,   0},
+		{236, 238, 236}, { 76, 154, 236}, {120, 124, 236}, {176,  98, 236}, {228,  84, 236}, {236,  88, 180}, {236, 106, 100}, {212, 136,  32},
+		{160, 170,   0}, {116, 196,   0}, { 76, 208,  32}, { 56, 204, 108}, { 56, 180, 204}, { 60,  60,  60}, {  0,   0,   0}, {  0,   0,   0},
+		{236, 238, 236}, {168, 204, 236}, {188, 188, 236}, {212, 178, 236}, {236, 174, 236}, {236, 174, 212}, {236, 180, 176}, {228, 194, 144},
+		{204, 210, 120}, {180, 222, 120}, {168, 226, 144}, {152, 226, 180}, {160, 214, 228}, {160, 162, 160}, {  0,   0,   0}, {  0,   0,   0}
+	} };
+}
\ No newline at end of file
@@ -1,7 +1,19 @@
 module Joypad;
 
+import Snapshot;
+
 namespace Joypad
 {
+	u8 GetHeldButtons(uint player_index)
+	{
+		u8 buttons = 0;
+		for (uint i = 0; i < 8; ++i) {
+			buttons |= players[player_index].button_currently_held[i] << i;
+		}
+		return buttons;
+	}
+
+
 	void NotifyButtonPressed(uint player_index, uint button_index)
 	{
 		if (player_index <= 2) {
@@ -85,16 +97,37 @@ namespace Joypad
 	}
 
 
-	void StreamState(SerializationStream& stream)
+	void SetHeldButtons(uint player_index, u8 buttons)
+	{
+		for (uint i = 0; i < 8; ++i) {
+			players[player_index].button_currently_held[i] = buttons >> i & 1;
+		}
+	}
+
+
+	void SetStrobeHook(void (*hook)())
+	{
+		strobe_hook = hook;
+	}
+
+
+	template<typename Stream>
+	void StreamState(Stream& stream)
 	{
 		stream.StreamArray(players);
 		stream.StreamPrimitive(strobe);
 		stream.StreamPrimitive(strobe_seq_completed);
 	}
 
+	template void StreamState(SerializationStream&);
+	template void StreamState(Snapshot&);
+
 
 	void WriteRegister(u16 addr, u8 data)
 	{
+		if (strobe_hook != nullptr) {
+			strobe_hook();
+		}
 		auto prev_strobe = strobe;
 		strobe = data & 1;
 		if (prev_strobe == 1 && strobe == 0) {
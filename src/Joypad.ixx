@@ -16,17 +16,25 @@ namespace Joypad
 			A, B, Select, Start, Up, Down, Left, Right
 		};
 
+		/* One bit per button held, in the order of Button (A in bit 0). */
+		u8 GetHeldButtons(uint player_index);
 		void NotifyButtonPressed(uint player_index, uint button_index);
 		void NotifyButtonReleased(uint player_index, uint button_index);
 		u8 PeekRegister(u16 addr);
 		u8 ReadRegister(u16 addr);
 		void Reset();
-		void StreamState(SerializationStream& stream);
+		void SetHeldButtons(uint player_index, u8 buttons);
+		/* 'hook' (or nullptr) is called on every write to $4016, before the write takes effect. This is where games poll
+		   the joypads, so input can be recorded or replaced there (see Movie). */
+		void SetStrobeHook(void (*hook)());
+		template<typename Stream> void StreamState(Stream& stream);
 		void WriteRegister(u16 addr, u8 data);
 	}
 
-	bool strobe;
-	bool strobe_seq_completed;
+	thread_local bool strobe;
+	thread_local bool strobe_seq_completed;
+
+	thread_local void (*strobe_hook)() = nullptr;
 
 	struct Player
 	{
@@ -35,5 +43,5 @@ namespace Joypad
 		uint button_return_index; // The index of the button to be returned on the next read to register $4016/$4017
 	};
 
-	std::array<Player, 2> players;
+	thread_local std::array<Player, 2> players;
 }
\ No newline at end of file
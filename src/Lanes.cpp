@@ -0,0 +1,148 @@
+module Lanes;
+
+import Bus;
+import CPU;
+import Joypad;
+import NES;
+
+import <algorithm>;
+import <future>;
+
+namespace Lanes
+{
+	Batch::Batch(uint num_lanes)
+		: observations(num_lanes), ram(ram_size * num_lanes)
+	{
+		lanes.reserve(num_lanes);
+		for (uint i = 0; i < num_lanes; ++i) {
+			lanes.push_back(std::make_unique<Emulator>());
+		}
+		registers.pc.resize(num_lanes);
+		registers.a.resize(num_lanes);
+		registers.x.resize(num_lanes);
+		registers.y.resize(num_lanes);
+		registers.p.resize(num_lanes);
+		registers.sp.resize(num_lanes);
+	}
+
+
+	void Batch::Gather(uint lane)
+	{
+		Observation& observation = observations[lane];
+		const CPU::TraceState cpu = CPU::GetTraceState();
+		observation.pc = cpu.pc;
+		observation.a = cpu.a;
+		observation.x = cpu.x;
+		observation.y = cpu.y;
+		observation.p = cpu.p;
+		observation.sp = cpu.sp;
+		std::ranges::copy(Bus::GetRam(), observation.ram.begin());
+	}
+
+
+	std::vector<u8> Batch::GetFramebuffer(uint lane)
+	{
+		return lanes[lane]->GetFramebuffer();
+	}
+
+
+	uint Batch::GetNumLanes() const
+	{
+		return uint(lanes.size());
+	}
+
+
+	std::span<const u8> Batch::GetRam() const
+	{
+		return ram;
+	}
+
+
+	const Registers& Batch::GetRegisters() const
+	{
+		return registers;
+	}
+
+
+	bool Batch::LoadRom(const std::string& path)
+	{
+		std::vector<std::future<bool>> results;
+		for (uint lane = 0; lane < GetNumLanes(); ++lane) {
+			results.push_back(lanes[lane]->Execute([this, lane, &path] {
+				if (!NES::LoadRom(path)) {
+					return false;
+				}
+				NES::Initialize();
+				Gather(lane);
+				return true;
+			}));
+		}
+		bool success = true;
+		for (std::future<bool>& result : results) {
+			success &= result.get();
+		}
+		Transpose();
+		return success;
+	}
+
+
+	bool Batch::LoadState(uint lane, Snapshot& snapshot)
+	{
+		const bool success = lanes[lane]->Execute([this, lane, &snapshot] {
+			if (!NES::LoadSnapshot(snapshot)) {
+				return false;
+			}
+			Gather(lane);
+			return true;
+		}).get();
+		Transpose();
+		return success;
+	}
+
+
+	void Batch::SaveState(uint lane, Snapshot& snapshot)
+	{
+		lanes[lane]->Execute([&snapshot] { NES::SaveSnapshot(snapshot); }).wait();
+	}
+
+
+	bool Batch::Step(std::span<const Input> inputs)
+	{
+		if (inputs.size() < GetNumLanes()) {
+			return false;
+		}
+		std::vector<std::future<void>> steps;
+		steps.reserve(GetNumLanes());
+		for (uint lane = 0; lane < GetNumLanes(); ++lane) {
+			steps.push_back(lanes[lane]->Execute([this, lane, input = inputs[lane]] {
+				Joypad::SetHeldButtons(0, input[0]);
+				Joypad::SetHeldButtons(1, input[1]);
+				NES::RunFramesWithoutOutput(1);
+				Gather(lane);
+			}));
+		}
+		for (std::future<void>& step : steps) {
+			step.wait();
+		}
+		Transpose();
+		return true;
+	}
+
+
+	void Batch::Transpose()
+	{
+		const uint num_lanes = GetNumLanes();
+		for (uint lane = 0; lane < num_lanes; ++lane) {
+			const Observation& observation = observations[lane];
+			registers.pc[lane] = observation.pc;
+			registers.a[lane] = observation.a;
+			registers.x[lane] = observation.x;
+			registers.y[lane] = observation.y;
+			registers.p[lane] = observation.p;
+			registers.sp[lane] = observation.sp;
+			for (uint addr = 0; addr < ram_size; ++addr) {
+				ram[addr * num_lanes + lane] = observation.ram[addr];
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+export module Lanes;
+
+import Emulator;
+import Snapshot;
+
+import NumericalTypes;
+
+import <array>;
+import <memory>;
+import <span>;
+import <string>;
+import <vector>;
+
+/* A batch of consoles ("lanes") running the same rom, stepped a frame at a time, each with its own input, e.g. as the
+   environments of a reinforcement learning agent. Every lane is an Emulator, so the lanes are stepped in parallel on their
+   own worker threads, and run without video or audio output. After every step, each lane copies its cpu registers and
+   internal RAM into a block of its own (cache line aligned, so that the workers never write to the same cache line), and
+   the calling thread then transposes the blocks structure-of-arrays: one array per register and one per RAM address, each
+   indexed by lane, so that an observation of the whole batch is contiguous.
+   Only the observations are structure-of-arrays. The lanes do not share instruction dispatch, nor execute in SIMD; each
+   is a scalar console with its own registers and RAM, as the cpu, bus and mapper state is per thread (see Emulator).
+   A lane costs as much as a single console, and the batch scales with the number of host cores, not with SIMD width. */
+namespace Lanes
+{
+	constexpr uint ram_size = 0x800;
+
+	export
+	{
+		using Input = std::array<u8, 2>; /* Joypad::GetHeldButtons of both players. */
+
+		struct Registers
+		{
+			std::vector<u16> pc;
+			std::vector<u8> a, x, y, p, sp;
+		};
+
+		class Batch
+		{
+		public:
+			explicit Batch(uint num_lanes);
+
+			std::vector<u8> GetFramebuffer(uint lane);
+			uint GetNumLanes() const;
+			/* The byte at 'addr' ($0000-$07FF) of the RAM of lane n is at index addr * GetNumLanes() + n. */
+			std::span<const u8> GetRam() const;
+			const Registers& GetRegisters() const;
+			/* Loads the rom into every lane and powers them on. */
+			bool LoadRom(const std::string& path);
+			/* E.g. to start a lane over from a state saved from any lane (see NES::LoadSnapshot). */
+			bool LoadState(uint lane, Snapshot& snapshot);
+			void SaveState(uint lane, Snapshot& snapshot);
+			/* Runs one frame on every lane, with lane n holding the buttons 'inputs[n]', and then gathers the registers and RAM.
+			   Fails if there are fewer inputs than lanes. */
+			bool Step(std::span<const Input> inputs);
+
+		private:
+			struct alignas(64) Observation
+			{
+				std::array<u8, ram_size> ram;
+				u16 pc;
+				u8 a, x, y, p, sp;
+			};
+
+			void Gather(uint lane); /* To be executed on the worker thread of the lane. */
+			void Transpose(); /* To be executed on the calling thread, once the lanes have gathered. */
+
+			std::vector<std::unique_ptr<Emulator>> lanes;
+			std::vector<Observation> observations; /* One per lane. */
+			std::vector<u8> ram;
+			Registers registers;
+		};
+	}
+}
\ No newline at end of file
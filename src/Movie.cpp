@@ -0,0 +1,213 @@
+module Movie;
+
+import Joypad;
+import NES;
+import PPU;
+
+import <algorithm>;
+import <fstream>;
+import <iterator>;
+
+namespace Movie
+{
+	u64 GetFrame()
+	{
+		return PPU::GetFrameCount() - first_frame;
+	}
+
+
+	u64 GetNumFrames()
+	{
+		return mode == Mode::Recording ? std::max(u64(inputs.size()), GetFrame()) : inputs.size();
+	}
+
+
+	bool IsPlaying()
+	{
+		return mode == Mode::Playing;
+	}
+
+
+	bool IsRecording()
+	{
+		return mode == Mode::Recording;
+	}
+
+
+	bool Load(const std::string& path)
+	{
+		/* The movie is only replaced if the whole file is valid: every count and size is checked against the bytes left in
+		   the file before anything is allocated, and the keyframes must start at frame 0, be in increasing order, and be
+		   loadable into the console (which Seek relies on). */
+		Stop();
+		std::ifstream file{ path, std::ifstream::in | std::ifstream::binary | std::ifstream::ate };
+		if (!file) {
+			return false;
+		}
+		u64 bytes_left = u64(file.tellg());
+		file.seekg(0);
+		auto read = [&file, &bytes_left](void* dst, u64 num_bytes) {
+			if (num_bytes > bytes_left || !file.read(reinterpret_cast<char*>(dst), std::streamsize(num_bytes))) {
+				return false;
+			}
+			bytes_left -= num_bytes;
+			return true;
+		};
+		Header header;
+		if (!read(&header, sizeof(Header)) || header.magic != magic || header.version != version ||
+			header.num_keyframes == 0 || header.num_frames > bytes_left / sizeof(Input)) {
+			return false;
+		}
+		std::vector<Input> new_inputs(header.num_frames);
+		if (!read(new_inputs.data(), new_inputs.size() * sizeof(Input)) || header.num_keyframes > bytes_left / (2 * sizeof(u64))) {
+			return false;
+		}
+		std::vector<Keyframe> new_keyframes(header.num_keyframes);
+		std::vector<u8> data;
+		for (size_t i = 0; i < new_keyframes.size(); ++i) {
+			Keyframe& keyframe = new_keyframes[i];
+			u64 size;
+			if (!read(&keyframe.frame, sizeof(u64)) || !read(&size, sizeof(u64)) || size > bytes_left) {
+				return false;
+			}
+			if (i == 0 ? keyframe.frame != 0 : keyframe.frame <= new_keyframes[i - 1].frame) {
+				return false;
+			}
+			data.resize(size);
+			if (!read(data.data(), size)) {
+				return false;
+			}
+			keyframe.snapshot.SetData(data);
+			if (!NES::CanLoadSnapshot(keyframe.snapshot)) {
+				return false;
+			}
+		}
+		keyframe_interval = header.keyframe_interval;
+		first_frame = header.first_frame;
+		inputs = std::move(new_inputs);
+		keyframes = std::move(new_keyframes);
+		return true;
+	}
+
+
+	void OnFrame()
+	{
+		if (mode == Mode::Recording && GetFrame() >= keyframes.back().frame + keyframe_interval) {
+			keyframes.emplace_back(GetFrame());
+			NES::SaveSnapshot(keyframes.back().snapshot);
+		}
+	}
+
+
+	void OnJoypadStrobe()
+	{
+		/* Frames that have been recorded are played back, also while recording (after seeking back). */
+		const u64 frame = GetFrame();
+		if (frame < inputs.size()) {
+			Joypad::SetHeldButtons(0, inputs[frame][0]);
+			Joypad::SetHeldButtons(1, inputs[frame][1]);
+		}
+		else if (mode == Mode::Recording) {
+			PadInputs(frame);
+			inputs.push_back({ Joypad::GetHeldButtons(0), Joypad::GetHeldButtons(1) });
+		}
+		else {
+			Stop(); /* The end of the movie; the joypads are back to the live input. */
+		}
+	}
+
+
+	void PadInputs(u64 num_frames)
+	{
+		/* The buttons held on frames without a strobe make no difference; they are taken to be those of the frame before. */
+		if (inputs.size() < num_frames) {
+			inputs.resize(num_frames, inputs.empty() ? Input{} : inputs.back());
+		}
+	}
+
+
+	bool Save(const std::string& path)
+	{
+		if (keyframes.empty()) {
+			return false;
+		}
+		if (mode == Mode::Recording) {
+			PadInputs(GetFrame());
+		}
+		std::ofstream file{ path, std::ofstream::out | std::ofstream::binary };
+		if (!file) {
+			return false;
+		}
+		const Header header = { magic, version, keyframe_interval, first_frame, inputs.size(), keyframes.size() };
+		file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		file.write(reinterpret_cast<const char*>(inputs.data()), inputs.size() * sizeof(Input));
+		for (const Keyframe& keyframe : keyframes) {
+			const u64 size = keyframe.snapshot.GetData().size();
+			file.write(reinterpret_cast<const char*>(&keyframe.frame), sizeof(u64));
+			file.write(reinterpret_cast<const char*>(&size), sizeof(u64));
+			file.write(reinterpret_cast<const char*>(keyframe.snapshot.GetData().data()), size);
+		}
+		return bool(file);
+	}
+
+
+	bool Seek(u64 frame)
+	{
+		if (mode == Mode::Stopped || frame > GetNumFrames()) {
+			return false;
+		}
+		/* The frame before 'frame' is always run, with video output, so that the framebuffer holds its picture. */
+		auto keyframe = std::prev(std::ranges::upper_bound(keyframes, frame > 0 ? frame - 1 : 0, {}, &Keyframe::frame));
+		if (!NES::LoadSnapshot(keyframe->snapshot)) {
+			return false;
+		}
+		if (mode == Mode::Recording) {
+			PadInputs(frame);
+			inputs.resize(frame);
+			keyframes.erase(std::next(keyframe), keyframes.end());
+		}
+		if (frame > keyframe->frame) {
+			NES::RunFramesWithoutOutput(uint(frame - keyframe->frame - 1));
+			NES::RunFrame();
+		}
+		return true;
+	}
+
+
+	bool StartPlayback()
+	{
+		if (keyframes.empty()) {
+			return false;
+		}
+		mode = Mode::Playing;
+		Joypad::SetStrobeHook(OnJoypadStrobe);
+		if (!Seek(0)) {
+			Stop();
+			return false;
+		}
+		return true;
+	}
+
+
+	void StartRecording(uint keyframe_interval)
+	{
+		Movie::keyframe_interval = std::max(keyframe_interval, 1u);
+		first_frame = PPU::GetFrameCount();
+		inputs.clear();
+		keyframes.clear();
+		keyframes.emplace_back(0);
+		NES::SaveSnapshot(keyframes.back().snapshot);
+		mode = Mode::Recording;
+		Joypad::SetStrobeHook(OnJoypadStrobe);
+	}
+
+
+	void Stop()
+	{
+		if (mode == Mode::Recording) {
+			PadInputs(GetFrame());
+		}
+		mode = Mode::Stopped;
+		Joypad::SetStrobeHook(nullptr);
+	}
+}
\ No newline at end of file
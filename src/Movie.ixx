@@ -0,0 +1,76 @@
+export module Movie;
+
+import Snapshot;
+
+import NumericalTypes;
+
+import <array>;
+import <string>;
+import <vector>;
+
+/* Input movies: the buttons held on both joypads on every frame, taken when the game strobes the joypads (see
+   Joypad::SetStrobeHook), together with a snapshot of the whole console (a keyframe) every 'keyframe_interval' frames.
+   The first keyframe is the state the recording was started from, so a movie plays back from there without the rom having
+   to be run from power-on. Seeking loads the last keyframe before the frame sought, and runs the frames in between without
+   video or audio output, but for the last one, i.e. takes at most 'keyframe_interval' frames of emulation.
+   Frames are counted by the PPU (see PPU::GetFrameCount), and the console is assumed to be run a whole frame at a time
+   (see NES::RunFrame), with the input only changed between frames; resets are not recorded. While recording, a keyframe is
+   only taken when OnFrame is called. The keyframes are only valid for the build and rom that saved them (see Snapshot). */
+namespace Movie
+{
+	export
+	{
+		/* The frame about to be run, counted from the start of the movie. */
+		u64 GetFrame();
+		u64 GetNumFrames();
+		bool IsPlaying();
+		bool IsRecording();
+		/* Loads a movie saved by Save; it is then played back with StartPlayback. */
+		bool Load(const std::string& path);
+		/* To be called after every frame while recording. */
+		void OnFrame();
+		bool Save(const std::string& path);
+		/* Goes to the start of 'frame', which is at most GetNumFrames(). While recording, everything recorded after it is
+		   dropped, and the recording continues from there. */
+		bool Seek(u64 frame);
+		/* Plays back the movie from its first frame; the joypad input is replaced by that of the movie until its end. */
+		bool StartPlayback();
+		/* Starts recording a new movie from the current state. Best called between calls to NES::RunFrame. */
+		void StartRecording(uint keyframe_interval = 600);
+		void Stop();
+	}
+
+	enum class Mode {
+		Stopped, Playing, Recording
+	};
+
+	struct Header
+	{
+		std::array<char, 8> magic;
+		u32 version;
+		u32 keyframe_interval;
+		u64 first_frame; /* PPU::GetFrameCount() at the start of the movie. */
+		u64 num_frames; /* Followed by one Input per frame. */
+		u64 num_keyframes; /* Followed by, for each one, its frame and size as two u64, and the data of its snapshot. */
+	};
+
+	using Input = std::array<u8, 2>; /* Joypad::GetHeldButtons of both players. */
+
+	struct Keyframe
+	{
+		u64 frame;
+		Snapshot snapshot;
+	};
+
+	void OnJoypadStrobe();
+	void PadInputs(u64 num_frames);
+
+	constexpr std::array<char, 8> magic = { 'N', 'E', 'S', 'M', 'O', 'V', 'I', 'E' };
+	constexpr u32 version = 1;
+
+	thread_local Mode mode = Mode::Stopped;
+	thread_local uint keyframe_interval;
+	thread_local u64 first_frame;
+	thread_local std::vector<Input> inputs; /* While recording, frames that did not strobe the joypads may be missing at the end. */
+	thread_local std::vector<Keyframe> keyframes;
+}
\ No newline at end of file
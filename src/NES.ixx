@@ -10,11 +10,32 @@ import System;
 
 import NumericalTypes;
 import SerializationStream;
+import Snapshot;
+import UserMessage;
 
+import <limits>;
 import <string>;
+import <type_traits>;
+
+namespace NES
+{
+	/* Streamed first into a SerializationStream, so that a state saved before its layout last changed is not loaded.
+	   To be bumped together with Snapshot::version. */
+	constexpr u32 serialization_version = 0x4E455302; /* 'NES' 2 */
+
+	thread_local bool audio_enabled = true;
+	thread_local size_t snapshot_size; /* See GetSnapshotSize; 0 until measured. */
+	thread_local Snapshot run_ahead_snapshot;
+}
+
 
 export namespace NES
 {
+	size_t GetSnapshotSize();
+	void SaveSnapshot(Snapshot& snapshot);
+	template<typename Stream> void StreamState(Stream& stream); /* SerializationStream or Snapshot */
+
+
 	void ApplyNewSampleRate()
 	{
 		APU::ApplyNewSampleRate();
@@ -27,6 +48,13 @@ export namespace NES
 	}
 
 
+	bool CanLoadSnapshot(const Snapshot& snapshot)
+	{
+		/* Whether LoadSnapshot would accept the snapshot, e.g. one read from a file (see Movie::Load). */
+		return snapshot.CanLoad(Cartridge::GetRomCrc(), GetSnapshotSize());
+	}
+
+
 	void Detach()
 	{
 		Cartridge::Eject();
@@ -35,13 +63,15 @@ export namespace NES
 
 	void DisableAudio()
 	{
-		// TODO
+		audio_enabled = false;
+		APU::SetOutputEnabled(false);
 	}
 
 
 	void EnableAudio()
 	{
-		// TODO
+		audio_enabled = true;
+		APU::SetOutputEnabled(true);
 	}
 
 
@@ -51,8 +81,22 @@ export namespace NES
 	}
 
 
+	size_t GetSnapshotSize()
+	{
+		/* The size of a snapshot saved by this console; only a snapshot of this size can be loaded (see Snapshot::BeginLoad).
+		   It is fixed by the rom, and measured by saving into a scratch snapshot the first time it is needed. */
+		if (snapshot_size == 0) {
+			Snapshot snapshot;
+			SaveSnapshot(snapshot);
+			snapshot_size = snapshot.GetData().size();
+		}
+		return snapshot_size;
+	}
+
+
 	void Initialize()
 	{
+		System::ResetScheduler();
 		APU::PowerOn();
 		Bus::PowerOn();
 		CPU::PowerOn();
@@ -60,6 +104,9 @@ export namespace NES
 		PPU::PowerOn();
 
 		CPU::RunStartUpCycles();
+		/* Between calls to Run*, where states are saved and loaded, no cpu cycles are left deferred (see System::CatchUp);
+		   otherwise those of the start-up would also be run after loading a state into a newly initialized console. */
+		System::CatchUp();
 	}
 
 
@@ -71,10 +118,23 @@ export namespace NES
 
 	bool LoadRom(const std::string& path)
 	{
+		snapshot_size = 0;
 		return Cartridge::LoadRom(path);
 	}
 
 
+	bool LoadSnapshot(Snapshot& snapshot)
+	{
+		/* Only valid between calls to Run*, like SaveSnapshot. Fails, before any state is changed, if the snapshot is empty,
+		   of another version, of another rom, or not of the size of one saved by this console. */
+		if (!snapshot.BeginLoad(Cartridge::GetRomCrc(), GetSnapshotSize())) {
+			return false;
+		}
+		StreamState(snapshot);
+		return snapshot.EndLoad();
+	}
+
+
 	void NotifyNewAxisValue(uint player_index, uint input_action_index, int axis_value)
 	{
 		/* no axes */
@@ -95,6 +155,7 @@ export namespace NES
 
 	void Reset()
 	{
+		System::ResetScheduler();
 		APU::Reset();
 		CPU::Reset();
 		Joypad::Reset();
@@ -104,12 +165,102 @@ export namespace NES
 
 	void Run()
 	{
+		/* Runs for a fixed number of cycles (CPU::cycle_run_len), regardless of where the PPU is within its frame. */
 		CPU::Run();
 	}
 
 
-	void StreamState(SerializationStream& stream)
+	uint RunCycles(uint num_cycles)
+	{
+		/* Runs up to the end of the instruction during which 'num_cycles' cycles have elapsed; returns the number of cycles run. */
+		return CPU::Run(num_cycles);
+	}
+
+
+	void RunFrame()
+	{
+		/* Runs up to the start of the next frame (PPU::PrepareForNewFrame), i.e. until the frame in progress has been fully
+		   rendered to the framebuffer, and the PPU is on the pre-render scanline. The cpu completes the instruction
+		   during which the frame ended, so the PPU may be a few dots into the new frame (or up to two scanlines, if the
+		   instruction started an OAM DMA). */
+		PPU::StopCpuAtScanline(PPU::pre_render_scanline);
+		CPU::Run(std::numeric_limits<uint>::max());
+	}
+
+
+	void RunFrameAhead(uint num_frames_ahead)
+	{
+		/* Run-ahead: removes 'num_frames_ahead' frames of the input lag built into a game (the frames between reading
+		   the joypads and showing the result), by running that many frames past the current one with the latest input,
+		   presenting the last of them, and going back to the state after the current one. Audio is only output for the
+		   current frame, so that it is not affected. The cost is 1 + 'num_frames_ahead' emulated frames and a snapshot
+		   load and save per presented frame (see NESBench --run-ahead). */
+		if (num_frames_ahead == 0) {
+			RunFrame();
+			return;
+		}
+		PPU::SetVideoOutputEnabled(false);
+		RunFrame();
+		SaveSnapshot(run_ahead_snapshot);
+		APU::SetOutputEnabled(false);
+		for (uint i = 1; i < num_frames_ahead; ++i) {
+			RunFrame();
+		}
+		PPU::SetVideoOutputEnabled(true);
+		RunFrame();
+		APU::SetOutputEnabled(audio_enabled);
+		LoadSnapshot(run_ahead_snapshot);
+	}
+
+
+	void RunFramesWithoutOutput(uint num_frames)
+	{
+		/* For fast-forwarding, e.g. to a frame of a movie (see Movie::Seek). */
+		PPU::SetVideoOutputEnabled(false);
+		APU::SetOutputEnabled(false);
+		for (uint i = 0; i < num_frames; ++i) {
+			RunFrame();
+		}
+		PPU::SetVideoOutputEnabled(true);
+		APU::SetOutputEnabled(audio_enabled);
+	}
+
+
+	bool RunUntilScanline(int scanline)
+	{
+		/* Runs until 'scanline' (-1 to standard.num_scanlines - 2) next starts, like RunFrame. */
+		if (scanline < PPU::pre_render_scanline || scanline > System::standard.num_scanlines - 2) {
+			return false;
+		}
+		PPU::StopCpuAtScanline(scanline);
+		CPU::Run(std::numeric_limits<uint>::max());
+		return true;
+	}
+
+
+	void SaveSnapshot(Snapshot& snapshot)
+	{
+		/* Takes a few microseconds; the buffer of the snapshot is reused. Best taken between calls to RunFrame (the
+		   framebuffer is not included). */
+		snapshot.BeginSave();
+		StreamState(snapshot);
+		snapshot.EndSave(Cartridge::GetRomCrc());
+	}
+
+
+	template<typename Stream>
+	void StreamState(Stream& stream)
 	{
+		if constexpr (std::is_same_v<Stream, SerializationStream>) {
+			/* When saving, the tag is written as is; when loading, it is replaced by that of the saved state. */
+			u32 version = serialization_version;
+			stream.StreamPrimitive(version);
+			if (version != serialization_version) {
+				UserMessage::Show("The save state was made by another version of the emulator, and cannot be loaded.",
+					UserMessage::Type::Error);
+				return;
+			}
+		}
 		APU::StreamState(stream);
 		Bus::StreamState(stream);
 		Cartridge::StreamState(stream);
@@ -1,19 +1,196 @@
+module;
+
+/* SSE2 is part of x86-64, so it needs no check of the cpu; elsewhere, the scanline compositor is scalar. */
+#if defined(_M_X64) || defined(__x86_64__)
+#define PPU_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 module PPU;
 
+import BaseMapper;
 import Bus;
 import Cartridge;
 import CPU;
+import FrameConversion;
+import Snapshot;
 import System;
 
 import Util.Bit;
 
 import Video;
 
+import <type_traits>;
+
 namespace PPU
 {
+	uint GetCpuCyclesUntilNextEvent()
+	{
+		/* Without the cpu accessing a PPU register, the PPU affects the cpu only by changing the NMI line at dot 1 of the nmi scanline (start of vblank)
+		   and of the pre-render scanline (end of vblank). Dots are counted from the start of the pre-render scanline. */
+		constexpr int dots_per_scanline = 341;
+		const int dot = (scanline - pre_render_scanline) * dots_per_scanline + scanline_cycle;
+		const int vblank_start_dot = (System::standard.nmi_scanline - pre_render_scanline) * dots_per_scanline + 1;
+		const int vblank_end_dot = System::standard.num_scanlines * dots_per_scanline + 1; /* dot 1 of the next frame */
+		int dots_until_event;
+		if (dot <= 1 && nmi_line == 0) {
+			dots_until_event = 1 - dot;
+		}
+		else if (dot <= vblank_start_dot) {
+			/* If NMIs are disabled, vblank starts and ends without the NMI line changing, unless PPUCTRL is written to. */
+			dots_until_event = vblank_start_dot - dot;
+			if (!ppuctrl.nmi_enable && nmi_line == 1) {
+				dots_until_event += System::standard.num_scanlines * dots_per_scanline;
+			}
+		}
+		else {
+			dots_until_event = vblank_end_dot - dot;
+		}
+		/* The start of the scanline to stop at must not be passed while the PPU is behind the cpu. */
+		if (stop_scanline != no_stop_scanline) {
+			int stop_dot = (stop_scanline - pre_render_scanline) * dots_per_scanline;
+			if (stop_dot <= dot) {
+				stop_dot += System::standard.num_scanlines * dots_per_scanline;
+			}
+			dots_until_event = std::min(dots_until_event, stop_dot - dot);
+		}
+		/* The pre-render scanline may be one dot shorter. On PAL, a cpu cycle may be four dots long. */
+		dots_until_event -= 1;
+		const int dots_per_cpu_cycle = System::standard.ppu_dots_per_cpu_cycle == 3 ? 3 : 4;
+		return dots_until_event > 0 ? dots_until_event / dots_per_cpu_cycle : 0;
+	}
+
+
+	uint GetCpuCyclesUntilStatusChange()
+	{
+		/* Without the cpu writing to a PPU register, reads from PPUSTATUS return something new only once vblank starts or ends,
+		   on sprite 0 hit or sprite overflow (only while rendering outside of vblank), or when one of the open bus bits 4-0 decays. */
+		constexpr int dots_per_scanline = 341;
+		const int dot = (scanline - pre_render_scanline) * dots_per_scanline + scanline_cycle;
+		const int vblank_start_dot = (System::standard.nmi_scanline - pre_render_scanline) * dots_per_scanline + 1;
+		const int vblank_end_dot = System::standard.num_scanlines * dots_per_scanline + 1; /* dot 1 of the next frame */
+		int dots_until_change;
+		if (dot <= 1) {
+			dots_until_change = 1 - dot;
+		}
+		else if (dot <= vblank_start_dot) {
+			dots_until_change = vblank_start_dot - dot;
+		}
+		else {
+			dots_until_change = vblank_end_dot - dot;
+		}
+		if (rendering_is_enabled && dot < vblank_start_dot) {
+			const int sprite_status_scanline = PredictSpriteStatusChange();
+			if (sprite_status_scanline <= scanline) {
+				return 0;
+			}
+			if (sprite_status_scanline != std::numeric_limits<int>::max()) {
+				const int sprite_status_dot = (sprite_status_scanline - pre_render_scanline) * dots_per_scanline;
+				dots_until_change = std::min(dots_until_change, sprite_status_dot - dot);
+			}
+		}
+		for (int n = 0; n < 5; n++) {
+			if (!open_bus_io.decayed[n] && (open_bus_io.value & 1 << n)) {
+				dots_until_change = std::min(dots_until_change,
+					int(OpenBusIO::decay_ppu_cycle_length - open_bus_io.ppu_cycles_since_refresh[n]));
+			}
+		}
+		dots_until_change -= 1;
+		const int dots_per_cpu_cycle = System::standard.ppu_dots_per_cpu_cycle == 3 ? 3 : 4;
+		return dots_until_change > 0 ? dots_until_change / dots_per_cpu_cycle : 0;
+	}
+
+
+	void ConvertFramebuffer(std::vector<u8>& output)
+	{
+		FrameConversion::Convert(framebuffer, scanline_emphasis, pixel_format, output.data());
+	}
+
+
+	int PredictSpriteStatusChange()
+	{
+		/* Returns the first scanline on which sprite 0 hit or sprite overflow may be set, provided that the cpu does not
+		   access the PPU in the meantime, or std::numeric_limits<int>::max() if neither can be set before vblank.
+		   Either flag is set on a scanline only if sprites were found in range of it, or of the scanline before it, during
+		   sprite evaluation: sprite 0 hit needs the first sprite evaluated to be in range, sprite overflow eight sprites in range
+		   (not counting the false positives of the overflow check, which come after those). The evaluation starts at the OAM
+		   byte that OAMADDR pointed to at dot 65. While rendering, OAMADDR is cleared at dots 257-320, so for every scanline
+		   after the current one, that is byte 0. The scanline returned may thus be too early, but never too late. */
+		constexpr int none = std::numeric_limits<int>::max();
+		const int last_visible_scanline = System::standard.num_visible_scanlines - 1;
+		const int sprite_height = ppuctrl.sprite_height ? 16 : 8;
+		auto in_range = [sprite_height](int line, u8 y) { return line >= y && line < y + sprite_height; };
+
+		/* Whether the evaluation of the current scanline is yet to come or still under way, and where it starts. */
+		const bool current_scanline_evaluation_pending = scanline >= 0 && scanline <= last_visible_scanline &&
+			(scanline_cycle <= 65 || scanline_cycle <= 256 && !sprite_evaluation.idle);
+		const uint current_first_addr = scanline_cycle <= 65 ? oamaddr : oamaddr_at_cycle_65;
+
+		int change_scanline = none;
+		if (!ppustatus.sprite_0_hit && ppumask.bg_enable && ppumask.sprite_enable) {
+			if (set_sprite_0_hit_flag || sprite_evaluation.sprite_0_included_current_scanline) {
+				return scanline;
+			}
+			if (sprite_evaluation.sprite_0_included_next_scanline ||
+				current_scanline_evaluation_pending && in_range(scanline, oam[current_first_addr]))
+			{
+				change_scanline = scanline + 1;
+			}
+			else {
+				const int first_evaluated_scanline = std::max(scanline + 1, int(oam[0]));
+				if (first_evaluated_scanline <= last_visible_scanline && in_range(first_evaluated_scanline, oam[0])) {
+					change_scanline = first_evaluated_scanline + 1;
+				}
+			}
+		}
+		if (!ppustatus.sprite_overflow) {
+			if (current_scanline_evaluation_pending) {
+				uint num_sprites_in_range = 0;
+				for (uint addr = current_first_addr; addr < oam.size(); addr += 4) {
+					num_sprites_in_range += in_range(scanline, oam[addr]);
+				}
+				if (num_sprites_in_range >= 8) {
+					return scanline;
+				}
+			}
+			/* The number of sprites in range of each scanline after the current one, as differences between consecutive ones. */
+			std::array<int, 257> num_sprites_in_range_diff{};
+			for (uint addr = 0; addr < oam.size(); addr += 4) {
+				const int first_scanline = std::max(scanline + 1, int(oam[addr]));
+				const int last_scanline = std::min(last_visible_scanline, oam[addr] + sprite_height - 1);
+				if (first_scanline <= last_scanline) {
+					num_sprites_in_range_diff[first_scanline]++;
+					num_sprites_in_range_diff[last_scanline + 1]--;
+				}
+			}
+			int num_sprites_in_range = 0;
+			for (int line = scanline + 1; line < std::min(change_scanline, last_visible_scanline + 1); ++line) {
+				num_sprites_in_range += num_sprites_in_range_diff[line];
+				if (num_sprites_in_range >= 8) {
+					return line;
+				}
+			}
+		}
+		return change_scanline;
+	}
+
+
 	uint GetFrameBufferSize() 
 	{ 
-		return num_pixels_per_scanline * System::standard.num_visible_scanlines * num_colour_channels;
+		return num_pixels_per_scanline * System::standard.num_visible_scanlines * FrameConversion::GetBytesPerPixel(pixel_format);
+	}
+
+
+	const std::vector<u8>& GetFramebuffer()
+	{
+		ConvertFramebuffer(output_framebuffer);
+		return output_framebuffer;
+	}
+
+
+	u64 GetFrameCount()
+	{
+		return frame_count;
 	}
 
 
@@ -36,11 +213,11 @@ namespace PPU
 		oamaddr = scroll.v = scroll.t = a12 = 0;
 		nmi_line = 1;
 		palette_ram = palette_ram_on_powerup;
-		framebuffer.resize(GetFrameBufferSize());
+		frame_count = 0;
+		framebuffer.resize(num_pixels_per_scanline * System::standard.num_visible_scanlines);
+		scanline_emphasis.resize(System::standard.num_visible_scanlines);
 
-		Video::SetFramebufferPtr(framebuffer.data());
-		Video::SetFramebufferSize(num_pixels_per_scanline, System::standard.num_visible_scanlines);
-		Video::SetPixelFormat(Video::PixelFormat::RGB888);
+		PPU::SetPixelFormat(pixel_format); /* Qualified, as ADL would also find Video::SetPixelFormat. */
 	}
 
 
@@ -51,32 +228,132 @@ namespace PPU
 		ppuscroll = ppudata = scroll.w = 0;
 		scanline_cycle = scanline = pixel_x_pos = framebuffer_pos = 0;
 		odd_frame = true;
-		rendering_is_enabled = false;
+		render_scanline_at_once = rendering_is_enabled = false;
+	}
+
+
+	void PresentFrame(TripleBuffer<std::vector<u8>>& frames)
+	{
+		if (frames.Acquire()) {
+			Video::SetFramebufferPtr(frames.GetFront().data());
+			Video::RenderGame();
+		}
+	}
+
+
+	void SetFrameOutput(std::function<void(std::span<const u8>)> output)
+	{
+		frame_output = std::move(output);
+		if (!frame_output) {
+			/* The front frame and the Video module's framebuffer pointer belong to the presentation thread while it runs. */
+			const bool presentation_thread_was_running = presentation.thread.joinable();
+			StopPresentationThread();
+			SetUpVideo();
+			if (presentation_thread_was_running) {
+				StartPresentationThread();
+			}
+		}
+	}
+
+
+	void SetPixelFormat(Video::PixelFormat format)
+	{
+		/* The frames cannot be resized while being presented. */
+		const bool presentation_thread_was_running = presentation.thread.joinable();
+		StopPresentationThread();
+		pixel_format = format;
+		output_framebuffer.resize(GetFrameBufferSize());
+		for (std::vector<u8>& frame : presentation.frames.GetBuffers()) {
+			frame.resize(GetFrameBufferSize());
+		}
+		if (!frame_output) {
+			SetUpVideo();
+		}
+		if (presentation_thread_was_running) {
+			StartPresentationThread();
+		}
 	}
 
 
-	void Update()
+	void SetUpVideo()
 	{
-		/* Update() is called once each cpu cycle.
+		Video::SetFramebufferSize(num_pixels_per_scanline, System::standard.num_visible_scanlines);
+		Video::SetFramebufferPtr(presentation.frames.GetFront().data());
+		Video::SetPixelFormat(pixel_format);
+	}
+
+
+	void SetVideoOutputEnabled(bool enabled)
+	{
+		video_output_enabled = enabled;
+	}
+
+
+	void StartPresentationThread()
+	{
+		if (presentation.thread.joinable()) {
+			return;
+		}
+		/* 'presentation' is thread_local, so the new thread is given the frames of this thread. */
+		presentation.thread = std::jthread([&frames = presentation.frames] {
+			while (frames.WaitForPublish()) {
+				PresentFrame(frames);
+			}
+		});
+	}
+
+
+	void StopPresentationThread()
+	{
+		if (presentation.thread.joinable()) {
+			presentation.frames.Close();
+			presentation.thread.join();
+			presentation.frames.Open();
+		}
+	}
+
+
+	void StopCpuAtScanline(int scanline_to_stop_at)
+	{
+		/* Also a scheduler event (see GetCpuCyclesUntilNextEvent), so that the stop is not delayed by deferred updates. */
+		stop_scanline = scanline_to_stop_at;
+	}
+
+
+	void Update(uint num_cpu_cycles)
+	{
+		/* The mapper type is resolved once, so that the cartridge accesses made while stepping are direct calls. */
+		Cartridge::VisitMapper([num_cpu_cycles]<typename Mapper>(Mapper&) {
+			for (cpu_cycles_left_in_update = num_cpu_cycles; cpu_cycles_left_in_update > 0; --cpu_cycles_left_in_update) {
+				StepCpuCycle<Mapper>();
+			}
+		});
+	}
+
+
+	template<typename Mapper>
+	void StepCpuCycle()
+	{
+		/* StepCpuCycle() is called once each cpu cycle.
 		   On NTSC/Dendy: 1 cpu cycle = 3 ppu cycles.
 		   On PAL       : 1 cpu cycle = 3.2 ppu cycles. */
 		if (System::standard.ppu_dots_per_cpu_cycle == 3) { /* NTSC/Dendy */
-			StepCycle();
-			StepCycle();
+			StepCycle<Mapper>();
+			StepCycle<Mapper>();
 			// The NMI edge detector and IRQ level detector is polled during the second half of each cpu cycle. Here, we are polling 2/3 in.
 			CPU::PollInterruptInputs();
-			StepCycle();
+			StepCycle<Mapper>();
 			/* Updated on a per-cpu-cycle basis, as precision isn't very important here. */
 			open_bus_io.UpdateDecay(3 /* elapsed ppu cycles */);
 		}
 		else { /* PAL */
-			StepCycle();
-			StepCycle();
+			StepCycle<Mapper>();
+			StepCycle<Mapper>();
 			CPU::PollInterruptInputs();
-			StepCycle();
+			StepCycle<Mapper>();
 			if (++cpu_cycle_counter == 5) {
 				/* This makes for a total of 3 * 5 + 1 = 16 = 3.2 * 5 ppu cycles per every 5 cpu cycles. */
-				StepCycle();
+				StepCycle<Mapper>();
 				cpu_cycle_counter = 0;
 				open_bus_io.UpdateDecay(4);
 			}
@@ -90,6 +367,7 @@ namespace PPU
 	}
 
 
+	template<typename Mapper>
 	void StepCycle()
 	{
 		if (set_sprite_0_hit_flag && scanline_cycle >= 2) {
@@ -100,7 +378,7 @@ namespace PPU
 			// Idle cycle on every scanline, except for if cycle 340 on the previous scanline was skipped. Then, we perform another dummy nametable fetch.
 			if (cycle_340_was_skipped_on_last_scanline) {
 				if (rendering_is_enabled) {
-					UpdateBGTileFetching();
+					UpdateBGTileFetching<Mapper>();
 				}
 				cycle_340_was_skipped_on_last_scanline = false;
 			}
@@ -116,12 +394,17 @@ namespace PPU
 				// The shifters are reloaded during ticks 9, 17, 25, ..., 257, i.e., if tile_fetch_cycle_step == 0 && scanline_cycle >= 9
 				// They are only reloaded on visible scanlines.
 				if (tile_fetcher.cycle_step == 0 && scanline_cycle >= 9 && scanline != pre_render_scanline) {
-					ReloadBackgroundShiftRegisters();
+					if (render_scanline_at_once) {
+						QueueBackgroundTile<Mapper>();
+					}
+					else {
+						ReloadBackgroundShiftRegisters();
+					}
 				}
 				// Update the BG tile fetching every cycle (if rendering is enabled).s
 				// Although no pixels are rendered on the pre-render scanline, the PPU still makes the same memory accesses it would for a regular scanline.
 				if (rendering_is_enabled) {
-					UpdateBGTileFetching();
+					UpdateBGTileFetching<Mapper>();
 				}
 				// Shift one pixel per cycle during cycles 1-256 on visible scanlines
 				// Sprite evaluation happens either if bg or sprite rendering is enabled, but not on the pre render scanline (oddly enough)
@@ -130,14 +413,27 @@ namespace PPU
 					if (scanline_cycle == 1) {
 						ppustatus.sprite_0_hit = ppustatus.sprite_overflow = ppustatus.vblank = 0;
 						CheckNMI();
-						Video::RenderGame();
 					}
 				}
 				else {
 					if (rendering_is_enabled) {
 						UpdateSpriteEvaluation();
 					}
-					ShiftPixel();
+					// Nothing that the pixels depend on can change until the cpu accesses the PPU, so if no access can be made before
+					// the last pixel is output, the pixels of the scanline are output all at once, at dot 256.
+					if (scanline_cycle == 1) {
+						render_scanline_at_once = rendering_is_enabled && cpu_cycles_left_in_update >= min_cpu_cycles_to_render_scanline_at_once;
+						if (render_scanline_at_once) {
+							StartBackgroundLine();
+						}
+					}
+					if (!render_scanline_at_once) {
+						ShiftPixel();
+					}
+					else if (scanline_cycle == 256) {
+						RenderScanline();
+						render_scanline_at_once = false;
+					}
 				}
 			}
 			else if (scanline_cycle <= 320) { // Cycles 257-320
@@ -169,7 +465,7 @@ namespace PPU
 						}
 						secondary_oam_sprite_index++;
 					}
-					UpdateSpriteTileFetching();
+					UpdateSpriteTileFetching<Mapper>();
 					if (scanline == pre_render_scanline && scanline_cycle >= 280 && scanline_cycle <= 304) {
 						// Copy the vertical bits of t to v
 						scroll.v = scroll.v & ~0x7BE0 | scroll.t & 0x7BE0;
@@ -194,7 +490,7 @@ namespace PPU
 				}
 				// Update BG tile fetching during each cycle. In total, two tiles are fetched + two nametable fetches.
 				if (rendering_is_enabled) {
-					UpdateBGTileFetching();
+					UpdateBGTileFetching<Mapper>();
 				}
 			}
 		}
@@ -202,7 +498,7 @@ namespace PPU
 		else if (scanline == System::standard.nmi_scanline && scanline_cycle == 1) {
 			ppustatus.vblank = 1;
 			CheckNMI();
-			SetA12(scroll.v & 0x1000); /* At the start of vblank, the bus address is set back to the video ram address. */
+			SetA12<Mapper>(scroll.v & 0x1000); /* At the start of vblank, the bus address is set back to the video ram address. */
 			scanline_cycle = 2;
 			return;
 		}
@@ -620,12 +916,21 @@ namespace PPU
 	}
 
 
+	void SetA12(bool new_val)
+	{
+		Cartridge::VisitMapper([new_val]<typename Mapper>(Mapper&) {
+			SetA12<Mapper>(new_val);
+		});
+	}
+
+
+	template<typename Mapper>
 	void SetA12(bool new_val)
 	{
 		if (a12 ^ new_val) {
 			if (new_val == 1) {
 				if (cpu_cycles_since_a12_set_low >= 3) {
-					Cartridge::ClockIRQ();
+					Cartridge::ClockIRQ<Mapper>();
 				}
 			}
 			else {
@@ -698,11 +1003,20 @@ namespace PPU
 			secondary_oam.fill(0xFF);
 			oamaddr_at_cycle_65 = oamaddr;
 			sprite_evaluation.Restart();
+			if (cpu_cycles_left_in_update >= min_cpu_cycles_to_evaluate_sprites_at_once) {
+				EvaluateSpritesAtOnce();
+			}
 			return;
 		}
 		if ((scanline_cycle & 1) || sprite_evaluation.idle) {
 			return;
 		}
+		StepSpriteEvaluation();
+	}
+
+
+	void StepSpriteEvaluation()
+	{
 		// Fetch the next entry in OAM
 		// The value of OAMADDR as it were at dot 65 is used as an offset to the address here.
 		// If OAMADDR is unaligned and does not point to the y-position (first byte) of an OAM entry, then whatever it points to will be reinterpreted as a y position, and the following bytes will be similarly reinterpreted.
@@ -747,6 +1061,72 @@ namespace PPU
 	}
 
 
+	void EvaluateSpritesAtOnce()
+	{
+		/* Runs the whole sprite evaluation of a scanline at dot 65, if its dots 65-256 are all run within one call to Update,
+		   i.e. if the cpu cannot access OAM, or change the sprite height or disable rendering, in between. The evaluation
+		   takes at most 64 + 3 * 8 steps, so it always goes idle within the 96 steps it is given over dots 66-256, and ends
+		   up the same as when stepped dot by dot.
+		   While fewer than eight sprites have been copied, the sprites that are not in range are skipped. Such a sprite only
+		   copies its y position to the next free entry of secondary OAM, where it is overwritten by the next sprite that is
+		   checked; only the last sprite of OAM is left there, if it is reached. The other steps (copying the sprites in range,
+		   and the buggy overflow check) are made one by one, as by UpdateSpriteEvaluation. */
+		const uint first_addr = oamaddr_at_cycle_65;
+		const uint last_sprite_index = (0xFF - first_addr) / 4; /* Of the last sprite that starts within OAM. */
+		const u8 sprite_height = ppuctrl.sprite_height ? 16 : 8;
+
+		/* Bit n: whether OAM byte n, taken as a y position, is in range of the scanline. */
+		std::array<u64, 4> y_in_range{};
+#ifdef PPU_USE_SSE2
+		/* 'scanline' - y is less than the sprite height when taken as unsigned, but wraps around for y > 'scanline'. */
+		const __m128i scanline_vec = _mm_set1_epi8(char(scanline));
+		const __m128i max_offset = _mm_set1_epi8(char(sprite_height - 1));
+		for (uint i = 0; i < 16; ++i) {
+			const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&oam[16 * i]));
+			const __m128i offset = _mm_sub_epi8(scanline_vec, y);
+			const __m128i in_range = _mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(offset, max_offset), offset),
+				_mm_cmpeq_epi8(_mm_min_epu8(y, scanline_vec), y));
+			y_in_range[i / 4] |= u64(u16(_mm_movemask_epi8(in_range))) << 16 * (i % 4);
+		}
+#else
+		for (uint addr = 0; addr < oam.size(); ++addr) {
+			if (scanline >= oam[addr] && scanline < oam[addr] + sprite_height) {
+				y_in_range[addr / 64] |= u64(1) << addr % 64;
+			}
+		}
+#endif
+		/* Only the bytes at the start of a sprite are taken as y positions while skipping. */
+		for (u64& bits : y_in_range) {
+			bits &= 0x1111111111111111ull << (first_addr & 3);
+		}
+		auto find_sprite_in_range = [&](uint sprite_index) {
+			for (uint addr = first_addr + 4 * sprite_index; addr < oam.size(); addr = (addr | 63) + 1) {
+				const u64 bits = y_in_range[addr / 64] & ~u64(0) << addr % 64;
+				if (bits != 0) {
+					return (addr / 64 * 64 + std::countr_zero(bits) - first_addr) / 4;
+				}
+			}
+			return last_sprite_index + 1;
+		};
+
+		while (!sprite_evaluation.idle) {
+			if (sprite_evaluation.num_sprites_copied < 8 && sprite_evaluation.byte_index == 0) {
+				const uint sprite_index = find_sprite_in_range(sprite_evaluation.sprite_index);
+				if (sprite_index > last_sprite_index) {
+					if (sprite_evaluation.sprite_index <= last_sprite_index) {
+						secondary_oam[4 * sprite_evaluation.num_sprites_copied] = oam[first_addr + 4 * last_sprite_index];
+					}
+					sprite_evaluation.sprite_index = last_sprite_index + 1;
+					sprite_evaluation.idle = true;
+					break;
+				}
+				sprite_evaluation.sprite_index = sprite_index;
+			}
+			StepSpriteEvaluation();
+		}
+	}
+
+
 	// Get an actual NES color (indexed 0-63) from a bg or sprite color id (0-3), given the palette id (0-3)
 	template<TileType tile_type>
 	u8 GetNESColorFromColorID(u8 col_id, u8 palette_id)
@@ -780,23 +1160,14 @@ namespace PPU
 
 	void PushPixelToFramebuffer(const u8 nes_col)
 	{
-		// From the nes colour (0-63), get an RGB24 colour from the predefined palette
-		// The palette from https://wiki.nesdev.org/w/index.php?title=PPU_palettes#2C02 was used for this
-		static constexpr std::array<RGB, 64> palette = { {
-			{ 84,  84,  84}, {  0,  30, 116}, {  8,  16, 144}, { 48,   0, 136}, { 68,   0, 100}, { 92,   0,  48}, { 84,   4,   0}, { 60,  24,   0},
-			{ 32,  42,   0}, {  8,  58,   0}, {  0,  64,   0}, {  0,  60,   0}, {  0,  50,  60}, {  0,   0,   0}, {  0,   0,   0}, {  0,   0,   0},
-			{152, 150, 152}, {  8,  76, 196}, { 48,  50, 236}, { 92,  30, 228}, {136,  20, 176}, {160,  20, 100}, {152,  34,  32}, {120,  60,   0},
-			{ 84,  90,   0}, { 40, 114,   0}, {  8, 124,   0}, {  0, 118,  40}, {  0, 102, 120}, {  0,   0,   0}, {  0,   0,   0}, {  0,   0,   0},
-			{236, 238, 236}, { 76, 154, 236}, {120, 124, 236}, {176,  98, 236}, {228,  84, 236}, {236,  88, 180}, {236, 106, 100}, {212, 136,  32},
-			{160, 170,   0}, {116, 196,   0}, { 76, 208,  32}, { 56, 204, 108}, { 56, 180, 204}, { 60,  60,  60}, {  0,   0,   0}, {  0,   0,   0},
-			{236, 238, 236}, {168, 204, 236}, {188, 188, 236}, {212, 178, 236}, {236, 174, 236}, {236, 174, 212}, {236, 180, 176}, {228, 194, 144},
-			{204, 210, 120}, {180, 222, 120}, {168, 226, 144}, {152, 226, 180}, {160, 214, 228}, {160, 162, 160}, {  0,   0,   0}, {  0,   0,   0}
-		} };
-
-		RGB col = palette[nes_col];
-		framebuffer[framebuffer_pos++] = col.r;
-		framebuffer[framebuffer_pos++] = col.g;
-		framebuffer[framebuffer_pos++] = col.b;
+		/* The colour emphasis of a scanline is that of its first pixel. The bits of red and green are swapped on PAL/Dendy. */
+		if (pixel_x_pos == 0) {
+			const u8 emphasis = std::bit_cast<u8>(ppumask) >> 5;
+			scanline_emphasis[framebuffer_pos / num_pixels_per_scanline] = System::standard.red_and_green_emphasis_bits_are_swapped
+				? emphasis & 4 | emphasis >> 1 & 1 | (emphasis & 1) << 1
+				: emphasis;
+		}
+		framebuffer[framebuffer_pos++] = nes_col;
 		pixel_x_pos++;
 	}
 
@@ -924,6 +1295,180 @@ namespace PPU
 	}
 
 
+	template<typename Mapper>
+	void QueueBackgroundTile()
+	{
+		/* In place of ReloadBackgroundShiftRegisters, while the scanline is rendered at once. The mapper cannot have been
+		   written to since the tile was fetched, so the decoded row at the fetch address is that of the fetched bytes. */
+		const uint i = bg_line.num_tiles++;
+		bg_line.pattern_rows[i] = Cartridge::ReadCHRRow<Mapper>(tile_fetcher.addr);
+		bg_line.last_pattern_low = tile_fetcher.pattern_table_tile_low;
+		bg_line.last_pattern_high = tile_fetcher.pattern_table_tile_high;
+		const u8 palette_id = tile_fetcher.attribute_table_byte >> (2 * tile_fetcher.attribute_table_quadrant) & 3;
+		bg_line.palette_rows[i] = 0x5555 * palette_id;
+	}
+
+
+	void RenderScanline()
+	{
+		/* Outputs the 256 pixels of the scanline, as ShiftPixel would over dots 1-256, and leaves the shift registers and the
+		   sprite x-position counters as they would then be. Only used within a single call to Update (see
+		   min_cpu_cycles_to_render_scanline_at_once), where the flags set here cannot be read before dot 256 anyway. */
+		alignas(16) std::array<u8, num_pixels_per_scanline> bg_pixels, sprite_pixels, palette_addrs;
+		DecodeBackgroundLine(bg_pixels);
+		DecodeSpriteLine(sprite_pixels);
+		if (MixScanline(bg_pixels, sprite_pixels, palette_addrs) && sprite_evaluation.sprite_0_included_current_scanline) {
+			ppustatus.sprite_0_hit = 1;
+		}
+		std::array<u8, 0x20> colours;
+		for (uint i = 0; i < colours.size(); ++i) {
+			colours[i] = ReadPaletteRAM(i);
+		}
+		for (u8 palette_addr : palette_addrs) {
+			PushPixelToFramebuffer(colours[palette_addr]);
+		}
+
+		/* The tile reloaded at dot 249 has been shifted into the upper bytes. */
+		bg_pattern_shift_reg[0] = bg_line.last_pattern_low << 8;
+		bg_pattern_shift_reg[1] = bg_line.last_pattern_high << 8;
+		bg_palette_attr_reg[0] = 0xFF00 * (bg_line.palette_rows[32] & 1);
+		bg_palette_attr_reg[1] = 0xFF00 * (bg_line.palette_rows[32] >> 1 & 1);
+		for (int& x_pos : sprite_x_pos_counter) {
+			x_pos -= num_pixels_per_scanline;
+		}
+	}
+
+
+	void DecodeBackgroundLine(std::span<u8, 256> pixels)
+	{
+		/* The background pixels of a scanline rendered at once, as bits 1-0: colour id, bits 3-2: palette id.
+		   Pixel x is pixel x + fine x scroll of the tiles of bg_line, so the eight pixels starting at a multiple of eight are
+		   those of two adjacent rows, shifted by the fine x scroll. */
+		if (!ppumask.bg_enable) {
+			std::ranges::fill(pixels, 0);
+			return;
+		}
+		const uint fine_x_shift = 2 * scroll.x;
+		std::array<u16, 32> pattern_spans, palette_spans;
+		for (uint tile = 0; tile < 32; ++tile) {
+			pattern_spans[tile] = (u32(bg_line.pattern_rows[tile]) << 16 | bg_line.pattern_rows[tile + 1]) << fine_x_shift >> 16;
+			palette_spans[tile] = (u32(bg_line.palette_rows[tile]) << 16 | bg_line.palette_rows[tile + 1]) << fine_x_shift >> 16;
+		}
+#ifdef PPU_USE_SSE2
+		/* Multiplying a span by 4^i moves its pixel i to the top two bits of a 16-bit lane. */
+		const __m128i pixel_to_top = _mm_setr_epi16(1, 4, 16, 64, 256, 1024, 4096, 16384);
+		auto decode_span = [&](uint tile) {
+			const __m128i col_ids = _mm_srli_epi16(_mm_mullo_epi16(_mm_set1_epi16(short(pattern_spans[tile])), pixel_to_top), 14);
+			const __m128i palette_ids = _mm_srli_epi16(_mm_mullo_epi16(_mm_set1_epi16(short(palette_spans[tile])), pixel_to_top), 14);
+			return _mm_or_si128(col_ids, _mm_slli_epi16(palette_ids, 2));
+		};
+		for (uint tile = 0; tile < 32; tile += 2) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&pixels[8 * tile]), _mm_packus_epi16(decode_span(tile), decode_span(tile + 1)));
+		}
+#else
+		for (uint x = 0; x < num_pixels_per_scanline; ++x) {
+			const uint shift = 14 - 2 * (x & 7);
+			pixels[x] = (pattern_spans[x >> 3] >> shift & 3) | (palette_spans[x >> 3] >> shift & 3) << 2;
+		}
+#endif
+		if (!ppumask.bg_left_col_enable) {
+			std::fill_n(pixels.begin(), 8, 0);
+		}
+	}
+
+
+	void DecodeSpriteLine(std::span<u8, 256> pixels)
+	{
+		/* The sprite pixels of a scanline rendered at once, from the sprites fetched for it on the scanline before, as
+		   bits 1-0: colour id, bits 3-2: palette id, bit 5: priority, bit 7: from sprite 0 of the scanline. The sprite of the
+		   lowest index with an opaque pixel is the one shown. */
+		std::ranges::fill(pixels, 0);
+		if (!ppumask.sprite_enable) {
+			return;
+		}
+		for (int i = 7; i >= 0; --i) {
+			const bool flip = sprite_attribute_latch[i] & 0x40;
+			const u8 attributes = (sprite_attribute_latch[i] & 3) << 2 | sprite_attribute_latch[i] & 0x20 | (i == 0 ? 0x80 : 0);
+			const u16 row = BaseMapper::DecodeCHRRow(sprite_pattern_shift_reg[2 * i], sprite_pattern_shift_reg[2 * i + 1]);
+			for (int offset = 0; offset < 8; ++offset) {
+				const int x = sprite_x_pos_counter[i] + offset;
+				if (x < 0 || x > 255 || x < 8 && !ppumask.sprite_left_col_enable) {
+					continue;
+				}
+				const u8 col_id = row >> 2 * (flip ? offset : 7 - offset) & 3;
+				if (col_id != 0) {
+					pixels[x] = col_id | attributes;
+				}
+			}
+		}
+	}
+
+
+	bool MixScanline(std::span<const u8, 256> bg_pixels, std::span<const u8, 256> sprite_pixels, std::span<u8, 256> palette_addrs)
+	{
+		/* Picks the palette RAM address of each pixel from its background and sprite pixels, as the priority multiplexer does,
+		   sixteen pixels at a time where SSE2 is available. Returns whether an opaque pixel of sprite 0 overlaps an opaque
+		   background pixel, other than at x = 255 (see ShiftPixel); the left-side clipping is already applied to both. */
+#ifdef PPU_USE_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i col_id_mask = _mm_set1_epi8(0x03);
+		const __m128i addr_mask = _mm_set1_epi8(0x0F);
+		const __m128i priority_bit = _mm_set1_epi8(0x20);
+		const __m128i sprite_0_bit = _mm_set1_epi8(u8(0x80));
+		const __m128i sprite_palettes = _mm_set1_epi8(0x10);
+		uint sprite_0_hit_mask = 0;
+		for (uint x = 0; x < num_pixels_per_scanline; x += 16) {
+			const __m128i bg = _mm_load_si128(reinterpret_cast<const __m128i*>(&bg_pixels[x]));
+			const __m128i sprite = _mm_load_si128(reinterpret_cast<const __m128i*>(&sprite_pixels[x]));
+			const __m128i bg_transparent = _mm_cmpeq_epi8(_mm_and_si128(bg, col_id_mask), zero);
+			const __m128i sprite_transparent = _mm_cmpeq_epi8(_mm_and_si128(sprite, col_id_mask), zero);
+			const __m128i sprite_behind_bg = _mm_andnot_si128(bg_transparent, _mm_cmpeq_epi8(_mm_and_si128(sprite, priority_bit), priority_bit));
+			const __m128i bg_shown = _mm_or_si128(sprite_transparent, sprite_behind_bg);
+			const __m128i bg_addrs = _mm_andnot_si128(bg_transparent, _mm_and_si128(bg, addr_mask));
+			const __m128i sprite_addrs = _mm_or_si128(_mm_and_si128(sprite, addr_mask), sprite_palettes);
+			_mm_store_si128(reinterpret_cast<__m128i*>(&palette_addrs[x]),
+				_mm_or_si128(_mm_and_si128(bg_shown, bg_addrs), _mm_andnot_si128(bg_shown, sprite_addrs)));
+			/* Only opaque sprite pixels have bit 7 set. */
+			const __m128i sprite_0_hit = _mm_andnot_si128(bg_transparent, _mm_cmpeq_epi8(_mm_and_si128(sprite, sprite_0_bit), sprite_0_bit));
+			sprite_0_hit_mask |= _mm_movemask_epi8(sprite_0_hit) & (x + 16 == num_pixels_per_scanline ? 0x7FFF : 0xFFFF);
+		}
+		return sprite_0_hit_mask != 0;
+#else
+		bool sprite_0_hit = false;
+		for (uint x = 0; x < num_pixels_per_scanline; ++x) {
+			const u8 bg_col_id = bg_pixels[x] & 3;
+			const u8 sprite_pixel = sprite_pixels[x];
+			const u8 sprite_col_id = sprite_pixel & 3;
+			if (sprite_col_id != 0 && bg_col_id != 0 && (sprite_pixel & 0x80) && x != 255) {
+				sprite_0_hit = true;
+			}
+			if (sprite_col_id != 0 && (!(sprite_pixel & 0x20) || bg_col_id == 0)) {
+				palette_addrs[x] = 0x10 | sprite_pixel & 0xF;
+			}
+			else {
+				palette_addrs[x] = bg_col_id == 0 ? 0 : bg_pixels[x] & 0xF;
+			}
+		}
+		return sprite_0_hit;
+#endif
+	}
+
+
+	void StartBackgroundLine()
+	{
+		/* The two tiles in the background shift registers at dot 1 are the first ones of the scanline. */
+		for (uint i = 0; i < 2; ++i) {
+			const uint shift = 8 - 8 * i;
+			bg_line.pattern_rows[i] = BaseMapper::DecodeCHRRow(bg_pattern_shift_reg[0] >> shift & 0xFF, bg_pattern_shift_reg[1] >> shift & 0xFF);
+			bg_line.palette_rows[i] = BaseMapper::DecodeCHRRow(bg_palette_attr_reg[0] >> shift & 0xFF, bg_palette_attr_reg[1] >> shift & 0xFF);
+		}
+		bg_line.last_pattern_low = bg_pattern_shift_reg[0] & 0xFF;
+		bg_line.last_pattern_high = bg_pattern_shift_reg[1] & 0xFF;
+		bg_line.num_tiles = 2;
+	}
+
+
+	template<typename Mapper>
 	void UpdateBGTileFetching()
 	{
 		/* Each memory access is two cycles long. On the first one, the address is loaded.
@@ -938,11 +1483,11 @@ namespace PPU
 			  ++----------------- Nametable base address ($2000)
 			*/
 			tile_fetcher.addr = 0x2000 | scroll.v & 0xFFF;
-			SetA12(0);
+			SetA12<Mapper>(0);
 			break;
 
 		case 1: /* Fetch nametable byte. */
-			tile_fetcher.tile_num = Cartridge::ReadNametableRAM(tile_fetcher.addr);
+			tile_fetcher.tile_num = Cartridge::ReadNametableRAM<Mapper>(tile_fetcher.addr);
 			break;
 
 		case 2: /* Compose address for attribute table byte. */
@@ -955,7 +1500,7 @@ namespace PPU
 			  ++------------------ Nametable base address ($2000)
 			*/
 			tile_fetcher.addr = 0x23C0 | (scroll.v & 0x0C00) | ((scroll.v >> 4) & 0x38) | ((scroll.v >> 2) & 0x07);
-			SetA12(0);
+			SetA12<Mapper>(0);
 			// Determine in which quadrant (0-3) of the 32x32 pixel metatile that the current tile is in
 			// topleft == 0, topright == 1, bottomleft == 2, bottomright = 3
 			// scroll-x % 4 and scroll-y % 4 give the "tile-coordinates" of the current tile in the metatile
@@ -963,7 +1508,7 @@ namespace PPU
 			break;
 
 		case 3: /* Fetch atttribute table byte. */
-			tile_fetcher.attribute_table_byte = Cartridge::ReadNametableRAM(tile_fetcher.addr);
+			tile_fetcher.attribute_table_byte = Cartridge::ReadNametableRAM<Mapper>(tile_fetcher.addr);
 			break;
 
 		case 4: { /* Compose address for pattern table tile low. */
@@ -978,22 +1523,22 @@ namespace PPU
 			*/
 			u16 pattern_table_half = ppuctrl.bg_tile_select ? 0x1000 : 0x0000;
 			tile_fetcher.addr = pattern_table_half | tile_fetcher.tile_num << 4 | scroll.v >> 12;
-			SetA12(pattern_table_half);
+			SetA12<Mapper>(pattern_table_half);
 			break;
 		}
 
 		case 5: /* Fetch pattern table tile low. */
-			tile_fetcher.pattern_table_tile_low = Cartridge::ReadCHR(tile_fetcher.addr);
+			tile_fetcher.pattern_table_tile_low = Cartridge::ReadCHR<Mapper>(tile_fetcher.addr);
 			break;
 
 		case 6: /* Compose address for pattern table tile high. This could be done in step 7 instead; it does not affect A12. */
 			// Technically, a game could change PPUCTRL_BG_TILE_SELECT here (?). What game would do that?
 			tile_fetcher.addr |= 0x0008;
-			SetA12(tile_fetcher.addr & 0x1000);
+			SetA12<Mapper>(tile_fetcher.addr & 0x1000);
 			break;
 
 		case 7: /* Fetch pattern table tile high. */
-			tile_fetcher.pattern_table_tile_high = Cartridge::ReadCHR(tile_fetcher.addr);
+			tile_fetcher.pattern_table_tile_high = Cartridge::ReadCHR<Mapper>(tile_fetcher.addr);
 			// Increment coarse x after fetching the tile.
 			scroll.IncrementCoarseX();
 			// Increment the coarse Y scroll at cycle 256, after all BG tiles have been fetched (will be the case when 'cycle_step' is 7)
@@ -1008,11 +1553,12 @@ namespace PPU
 	}
 
 
+	template<typename Mapper>
 	void UpdateSpriteTileFetching()
 	{
 		switch (tile_fetcher.cycle_step++) {
 		case 0: case 2: /* Prepare address for garbage nametable fetches. The important thing is to update A12. */
-			SetA12(ppuctrl.bg_tile_select); // TODO: should PPUCTRL_SPRITE_TILE_SELECT be used instead? Probably not.
+			SetA12<Mapper>(ppuctrl.bg_tile_select); // TODO: should PPUCTRL_SPRITE_TILE_SELECT be used instead? Probably not.
 			break;
 
 		case 1: case 3: /* Garbage nametable fetches. */
@@ -1059,21 +1605,21 @@ namespace PPU
 			else { // 8x8 sprites
 				tile_fetcher.addr = (ppuctrl.sprite_tile_select ? 0x1000 : 0x0000) | tile_fetcher.tile_num << 4 | sprite_row_num;
 			}
-			SetA12(tile_fetcher.addr & 0x1000);
+			SetA12<Mapper>(tile_fetcher.addr & 0x1000);
 			break;
 		}
 
 		case 5: /* Fetch pattern table tile low. */
-			tile_fetcher.pattern_table_tile_low = Cartridge::ReadCHR(tile_fetcher.addr);
+			tile_fetcher.pattern_table_tile_low = Cartridge::ReadCHR<Mapper>(tile_fetcher.addr);
 			break;
 
 		case 6: /* Compose address for pattern table tile high. This could be done in step 7 instead. */
 			tile_fetcher.addr |= 0x0008;
-			SetA12(tile_fetcher.addr & 0x1000);
+			SetA12<Mapper>(tile_fetcher.addr & 0x1000);
 			break;
 
 		case 7: /* Fetch pattern table tile high. */
-			tile_fetcher.pattern_table_tile_high = Cartridge::ReadCHR(tile_fetcher.addr);
+			tile_fetcher.pattern_table_tile_high = Cartridge::ReadCHR<Mapper>(tile_fetcher.addr);
 			break;
 
 		default: // impossible
@@ -1123,6 +1669,19 @@ namespace PPU
 
 	void PrepareForNewFrame()
 	{
+		/* The last visible scanline has been rendered. This is also where NES::RunFrame stops. */
+		if (video_output_enabled && frame_output) {
+			ConvertFramebuffer(output_framebuffer);
+			frame_output(output_framebuffer);
+		}
+		else if (video_output_enabled) {
+			ConvertFramebuffer(presentation.frames.GetBack());
+			presentation.frames.Publish();
+			if (!presentation.thread.joinable()) {
+				PresentFrame(presentation.frames);
+			}
+		}
+		frame_count++;
 		odd_frame = !odd_frame;
 		framebuffer_pos = 0;
 	}
@@ -1140,10 +1699,15 @@ namespace PPU
 		pixel_x_pos = 0;
 		sprite_evaluation.sprite_0_included_current_scanline = sprite_evaluation.sprite_0_included_next_scanline;
 		sprite_evaluation.sprite_0_included_next_scanline = false;
+		if (scanline == stop_scanline) {
+			stop_scanline = no_stop_scanline;
+			CPU::StopRun();
+		}
 	}
 
 
-	void StreamState(SerializationStream& stream)
+	template<typename Stream>
+	void StreamState(Stream& stream)
 	{
 		stream.StreamPrimitive(open_bus_io);
 		stream.StreamPrimitive(scroll);
@@ -1172,6 +1736,7 @@ namespace PPU
 		stream.StreamPrimitive(scanline);
 
 		stream.StreamPrimitive(cpu_cycle_counter);
+		stream.StreamPrimitive(frame_count);
 		stream.StreamPrimitive(framebuffer_pos);
 		stream.StreamPrimitive(scanline_cycle);
 		stream.StreamPrimitive(secondary_oam_sprite_index);
@@ -1187,6 +1752,13 @@ namespace PPU
 
 		stream.StreamArray(sprite_x_pos_counter);
 
-		stream.StreamVector(framebuffer);
+		/* Snapshots are taken between frames, and the framebuffer is completely overwritten before the next frame is presented. */
+		if constexpr (!std::is_same_v<Stream, Snapshot>) {
+			stream.StreamVector(framebuffer);
+			stream.StreamVector(scanline_emphasis);
+		}
 	}
+
+	template void StreamState(SerializationStream&);
+	template void StreamState(Snapshot&);
 }
\ No newline at end of file
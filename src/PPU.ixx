@@ -1,28 +1,63 @@
 export module PPU;
 
+import FrameConversion;
+import TripleBuffer;
+
 import NumericalTypes;
 import SerializationStream;
 
+import Video;
+
 import <algorithm>;
 import <array>;
 import <bit>;
 import <format>;
+import <functional>;
 import <limits>;
+import <span>;
+import <thread>;
+import <utility>;
 import <vector>;
 
 namespace PPU
 {
 	export
 	{
+		/* Scanlines are numbered from -1 (pre-render; a new frame starts with it) to standard.num_scanlines - 2. */
+		constexpr int pre_render_scanline = -1;
+
+		/* The picture in the pixel format set by SetPixelFormat, converted from the colours output so far (see FrameConversion).
+		   Between frames (see NES::RunFrame), that of the last frame, whether or not it was passed on to the Video module. */
+		const std::vector<u8>& GetFramebuffer();
+		uint GetCpuCyclesUntilNextEvent();
+		uint GetCpuCyclesUntilStatusChange();
 		uint GetFrameBufferSize();
+		u64 GetFrameCount();
 		u8 PeekOAMDMA();
 		u8 PeekRegister(u16 addr);
 		void PowerOn();
 		u8 ReadOAMDMA();
 		u8 ReadRegister(u16 addr);
 		void Reset();
-		void StreamState(SerializationStream& stream);
-		void Update();
+		/* When set, finished frames are passed to 'output', on the thread running the console, instead of to the Video module,
+		   which is then left untouched. This keeps the picture of each console apart, as the Video module is shared by the whole
+		   process. Pass an empty function to go back to the Video module. */
+		void SetFrameOutput(std::function<void(std::span<const u8>)> output);
+		/* Of the frames passed on to the Video module or to the frame output, and of GetFramebuffer. RGB888 by default. */
+		void SetPixelFormat(Video::PixelFormat format);
+		/* Makes finished frames be presented (see Video::RenderGame) on a thread of their own, handed over through a triple
+		   buffer, so that the console never waits for the presentation, nor overwrites a frame being presented. Until then,
+		   or after StopPresentationThread, they are presented on the thread running the console, when they are finished.
+		   The Video module must then allow RenderGame to be called from another thread than the rest of its functions. */
+		void StartPresentationThread();
+		void StopPresentationThread();
+		/* While cleared, finished frames are not passed on to the Video module nor to the frame output (e.g. those run ahead; see
+		   NES::RunFrameAhead). */
+		void SetVideoOutputEnabled(bool enabled);
+		/* Makes the cpu stop running (see CPU::StopRun) once 'scanline' next starts, i.e. at its dot 0. */
+		void StopCpuAtScanline(int scanline);
+		template<typename Stream> void StreamState(Stream& stream);
+		void Update(uint num_cpu_cycles = 1);
 		void WriteOAMDMA(u8 data);
 		void WriteRegister(u16 addr, u8 data);
 	}
@@ -31,35 +66,46 @@ namespace PPU
 		BG, OBJ
 	};
 
-	struct RGB
-	{
-		u8 r, g, b;
-	};
-
 	template<TileType>
 	u8 GetNESColorFromColorID(u8 col_id, u8 palette_id);
 
+	/* Instantiated per concrete mapper type (see Cartridge::VisitMapper). */
+	template<typename Mapper> void SetA12(bool new_val);
+	template<typename Mapper> void StepCpuCycle();
+	template<typename Mapper> void StepCycle();
+	template<typename Mapper> void UpdateBGTileFetching();
+	template<typename Mapper> void UpdateSpriteTileFetching();
+
 	void CheckNMI();
+	void ConvertFramebuffer(std::vector<u8>& output);
+	void PresentFrame(TripleBuffer<std::vector<u8>>& frames);
+	void DecodeBackgroundLine(std::span<u8, 256> pixels);
+	void DecodeSpriteLine(std::span<u8, 256> pixels);
+	void EvaluateSpritesAtOnce();
 	bool InVblank();
+	bool MixScanline(std::span<const u8, 256> bg_pixels, std::span<const u8, 256> sprite_pixels, std::span<u8, 256> palette_addrs);
+	int PredictSpriteStatusChange();
 	void PrepareForNewFrame();
 	void PrepareForNewScanline();
 	void PushPixelToFramebuffer(u8 nes_col);
+	template<typename Mapper> void QueueBackgroundTile();
 	u8 ReadMemory(u16 addr);
 	u8 ReadPaletteRAM(u16 addr);
 	void ReloadBackgroundShiftRegisters();
 	void ReloadSpriteShiftRegisters(uint sprite_index);
+	void RenderScanline();
+	void StartBackgroundLine();
+	void StepSpriteEvaluation();
 	void SetA12(bool new_val);
+	void SetUpVideo();
 	void ShiftPixel();
-	void StepCycle();
-	void UpdateBGTileFetching();
 	void UpdateSpriteEvaluation();
-	void UpdateSpriteTileFetching();
 	void WriteMemory(u16 addr, u8 data);
 	void WritePaletteRAM(u16 addr, u8 data);
 
 	// PPU IO open bus related. See https://wiki.nesdev.org/w/index.php?title=PPU_registers#Ports
 	// and the 'NES PPU Open-Bus Test' test rom readme
-	struct OpenBusIO
+	thread_local struct OpenBusIO
 	{
 		OpenBusIO() { decayed.fill(true); }
 
@@ -75,7 +121,7 @@ namespace PPU
 		std::array<uint, 8> ppu_cycles_since_refresh{};
 	} open_bus_io;
 
-	struct ScrollRegisters
+	thread_local struct ScrollRegisters
 	{
 		void IncrementCoarseX();
 		void IncrementFineY();
@@ -93,7 +139,7 @@ namespace PPU
 		bool w; // First or second $2005/$2006 write toggle (1 bit)
 	} scroll;
 
-	struct SpriteEvaluation
+	thread_local struct SpriteEvaluation
 	{
 		void IncrementByteIndex();
 		void IncrementSpriteIndex();
@@ -110,7 +156,7 @@ namespace PPU
 		bool sprite_0_included_next_scanline = false;
 	} sprite_evaluation;
 
-	struct TileFetcher
+	thread_local struct TileFetcher
 	{
 		void StartOver();
 
@@ -131,8 +177,24 @@ namespace PPU
 		uint cycle_step : 3; // (0-7)
 	} tile_fetcher;
 
-	constexpr int pre_render_scanline = -1;
-	constexpr uint num_colour_channels = 3;
+	/* The background tiles of a scanline rendered at once (see RenderScanline), in the order they would have been shifted
+	   out of the background shift registers: the two tiles in the registers at dot 1, and those reloaded at dots 9-249.
+	   The rows are decoded as by BaseMapper::DecodeCHRRow, two bits per pixel. */
+	thread_local struct BackgroundLine
+	{
+		std::array<u16, 34> pattern_rows;
+		std::array<u16, 34> palette_rows; /* The palette id of the tile in every pixel. */
+		u8 last_pattern_low, last_pattern_high; /* Of the last tile, which is left in the shift registers after dot 256. */
+		uint num_tiles;
+	} bg_line;
+
+	/* A scanline is rendered at once if its dots 1-256 are all run within the same call to Update, i.e. without the cpu
+	   getting to write to a register in between. Reaching dot 256 from dot 1 takes 255 more dots, and a cpu cycle is at
+	   least three dots. */
+	constexpr uint min_cpu_cycles_to_render_scanline_at_once = 86;
+	/* Likewise for the sprite evaluation over dots 65-256 (see EvaluateSpritesAtOnce). */
+	constexpr uint min_cpu_cycles_to_evaluate_sprites_at_once = 65;
+	constexpr int no_stop_scanline = std::numeric_limits<int>::min();
 	constexpr uint num_pixels_per_scanline = 256; // Horizontal resolution
 
 	/* "A12" refers to the 12th ppu address bus pin.
@@ -141,16 +203,18 @@ namespace PPU
 	   for the reason that the address bus pins outside of rendering are set to the vram address (scroll.v).
 	   MMC3 contains a scanline counter that gets clocked when A12 (0 -> 1), once A12 has remained low for 3 cpu cycles.
 	   TODO: in the future: consider the entire address bus, not just A12? This is basically just to get MMC3 to work. */
-	bool a12;
-	bool cycle_340_was_skipped_on_last_scanline; // On NTSC, cycle 340 of the pre render scanline may be skipped every other frame.
-	bool nmi_line;
-	bool odd_frame;
-	bool rendering_is_enabled; /* == ppumask.bg_enable || ppumask.sprite_enable */
-	bool set_sprite_0_hit_flag;
-
-	u8 pixel_x_pos;
-
-	struct
+	thread_local bool a12;
+	thread_local bool cycle_340_was_skipped_on_last_scanline; // On NTSC, cycle 340 of the pre render scanline may be skipped every other frame.
+	thread_local bool nmi_line;
+	thread_local bool odd_frame;
+	thread_local bool render_scanline_at_once; /* Set at dot 1 of a visible scanline; see RenderScanline. */
+	thread_local bool rendering_is_enabled; /* == ppumask.bg_enable || ppumask.sprite_enable */
+	thread_local bool set_sprite_0_hit_flag;
+	thread_local bool video_output_enabled = true;
+
+	thread_local u8 pixel_x_pos;
+
+	thread_local struct
 	{
 		u8 nametable_select : 2; /* Base nametable address (0 = $2000; 1 = $2400; 2 = $2800; 3 = $2C00) */
 		u8 incr_mode : 1; /* VRAM address increment per CPU read/write of PPUDATA (0: add 1, going across; 1: add 32, going down) */
@@ -161,7 +225,7 @@ namespace PPU
 		u8 nmi_enable : 1; /* Generate an NMI at the start of the vertical blanking interval (0: off; 1: on) */
 	} ppuctrl;
 
-	struct
+	thread_local struct
 	{
 		u8 greyscale : 1; /* 0: normal color, 1: produce a greyscale display */
 		u8 bg_left_col_enable : 1; /* 1: Show background in leftmost 8 pixels of screen, 0: Hide */
@@ -173,7 +237,7 @@ namespace PPU
 		u8 emphasize_blue : 1; /* Emphasize blue */
 	} ppumask;
 
-	struct
+	thread_local struct
 	{
 		/* Least significant bits previously written into a PPU register
 			(due to register not being updated for this address) */
@@ -197,31 +261,49 @@ namespace PPU
 		u8 vblank : 1;
 	} ppustatus;
 
-	u8 ppuscroll;
-	u8 ppudata;
-	u8 oamaddr;
-	u8 oamdma;
+	thread_local u8 ppuscroll;
+	thread_local u8 ppudata;
+	thread_local u8 oamaddr;
+	thread_local u8 oamdma;
+
+	thread_local u8 oamaddr_at_cycle_65;
+
+	thread_local int scanline;
+	thread_local int stop_scanline = no_stop_scanline; /* See StopCpuAtScanline. Not part of the console state. */
 
-	u8 oamaddr_at_cycle_65;
+	thread_local uint cpu_cycle_counter; /* Used in PAL mode to sync ppu to cpu */
+	thread_local uint cpu_cycles_left_in_update; /* Including the one being stepped. */
+	thread_local uint cpu_cycles_since_a12_set_low = 0;
+	thread_local uint framebuffer_pos;
+	thread_local uint scanline_cycle;
+	thread_local uint secondary_oam_sprite_index /* (0-7) index of the sprite currently being fetched (ppu dots 257-320). */;
 
-	int scanline;
+	thread_local u64 frame_count; /* Frames started since power on. */
 
-	uint cpu_cycle_counter; /* Used in PAL mode to sync ppu to cpu */
-	uint cpu_cycles_since_a12_set_low = 0;
-	uint framebuffer_pos;
-	uint scanline_cycle;
-	uint secondary_oam_sprite_index /* (0-7) index of the sprite currently being fetched (ppu dots 257-320). */;
+	thread_local std::array<u8, 0x100 > oam; /* Not mapped. Holds sprite data (four bytes each for up to 64 sprites). */
+	thread_local std::array<u8, 0x20  > palette_ram; /* Mapped to PPU $3F00-$3F1F (mirrored at $3F20-$3FFF). */
+	thread_local std::array<u8, 0x20  > secondary_oam; /* Holds sprite data for sprites to be rendered on the next scanline. */
 
-	std::array<u8, 0x100 > oam; /* Not mapped. Holds sprite data (four bytes each for up to 64 sprites). */
-	std::array<u8, 0x20  > palette_ram; /* Mapped to PPU $3F00-$3F1F (mirrored at $3F20-$3FFF). */
-	std::array<u8, 0x20  > secondary_oam; /* Holds sprite data for sprites to be rendered on the next scanline. */
+	thread_local std::array<u8, 8> sprite_attribute_latch;
+	thread_local std::array<u8, 16> sprite_pattern_shift_reg;
+	thread_local std::array<u16, 2> bg_palette_attr_reg; // These are actually 8 bits on real HW, but it's easier this way. Similar to the pattern shift registers, the MSB contain data for the current tile, and the bottom LSB for the next tile.
+	thread_local std::array<u16, 2> bg_pattern_shift_reg;
 
-	std::array<u8, 8> sprite_attribute_latch;
-	std::array<u8, 16> sprite_pattern_shift_reg;
-	std::array<u16, 2> bg_palette_attr_reg; // These are actually 8 bits on real HW, but it's easier this way. Similar to the pattern shift registers, the MSB contain data for the current tile, and the bottom LSB for the next tile.
-	std::array<u16, 2> bg_pattern_shift_reg;
+	thread_local std::array<int, 8> sprite_x_pos_counter;
 
-	std::array<int, 8> sprite_x_pos_counter;
+	thread_local Video::PixelFormat pixel_format = Video::PixelFormat::RGB888;
 
-	std::vector<u8> framebuffer;
+	thread_local std::vector<u8> framebuffer; /* The colour (0-63) of every pixel. */
+	thread_local std::vector<u8> output_framebuffer; /* 'framebuffer' converted to 'pixel_format', for GetFramebuffer. */
+	thread_local std::vector<FrameConversion::Emphasis> scanline_emphasis;
+
+	thread_local std::function<void(std::span<const u8>)> frame_output; /* See SetFrameOutput. */
+
+	/* Finished frames converted to 'pixel_format'; the PPU produces them, and they are presented from the front buffer. */
+	thread_local struct Presentation
+	{
+		TripleBuffer<std::vector<u8>> frames;
+		std::jthread thread; /* Declared last, so that it is joined before 'frames' is destroyed. */
+		~Presentation() { frames.Close(); }
+	} presentation;
 };
\ No newline at end of file
@@ -0,0 +1,259 @@
+module Profiler;
+
+import Bus;
+import Cartridge;
+
+import <algorithm>;
+import <format>;
+import <fstream>;
+import <ranges>;
+
+namespace Profiler
+{
+	void Call(u32 function, int entry_sp)
+	{
+		if (call_stack.size() == max_call_depth) {
+			return;
+		}
+		const u32 parent = call_stack.back().node;
+		auto [child, inserted] = call_tree_children.try_emplace(u64(parent) << 32 | function, u32(call_tree.size()));
+		if (inserted) {
+			call_tree.push_back({ .function = function, .parent = parent, .cycles = 0 });
+		}
+		call_stack.push_back({ .node = child->second, .entry_sp = entry_sp });
+	}
+
+
+	void Charge(u64 cycle)
+	{
+		if (last_counts != nullptr) {
+			last_counts->cycles += cycle - last_cycle;
+			call_tree[last_node].cycles += cycle - last_cycle;
+		}
+		last_cycle = cycle;
+	}
+
+
+	Counts& CountsAt(u16 addr)
+	{
+		std::optional<size_t> offset = GetPrgRomOffset(addr);
+		return offset.has_value() ? prg_rom_counts[offset.value()] : other_counts[addr];
+	}
+
+
+	u32 FunctionKey(u16 addr)
+	{
+		std::optional<size_t> offset = GetPrgRomOffset(addr);
+		return offset.has_value() ? u32(offset.value()) : function_outside_prg_rom + addr;
+	}
+
+
+	std::string FunctionName(u32 function)
+	{
+		if (function == function_reset) {
+			return "RESET";
+		}
+		if (function >= function_interrupt) {
+			switch (CPU::InterruptType(function - function_interrupt)) {
+			case CPU::InterruptType::BRK: return "BRK";
+			case CPU::InterruptType::IRQ: return "IRQ";
+			case CPU::InterruptType::NMI: return "NMI";
+			}
+		}
+		if (function >= function_outside_prg_rom) {
+			return std::format("{:04X}", function - function_outside_prg_rom);
+		}
+		return std::format("{:02X}:{:04X}", function / bank_size, prg_rom_counts[function].addr);
+	}
+
+
+	std::optional<size_t> GetPrgRomOffset(u16 addr)
+	{
+		if (const u8* page = Bus::GetReadOnlyPage(addr)) {
+			const u8* host_addr = page + addr % Bus::page_size;
+			if (host_addr >= prg_rom.data() && host_addr < prg_rom.data() + prg_rom.size()) {
+				return host_addr - prg_rom.data();
+			}
+		}
+		return {};
+	}
+
+
+	bool IsRunning()
+	{
+		return Debug::IsTracerAttached(&profiler);
+	}
+
+
+	void Return(int sp)
+	{
+		/* 'sp' is the stack pointer after the return address has been pulled. The root frame is never popped. */
+		while (call_stack.size() > 1 && call_stack.back().entry_sp <= sp) {
+			call_stack.pop_back();
+		}
+	}
+
+
+	void Start()
+	{
+		prg_rom = Cartridge::GetPrgRom();
+		prg_rom_counts.assign(prg_rom.size(), {});
+		other_counts.assign(0x10000, {});
+		interrupt_counts = {};
+		call_tree.assign(1, { .function = function_reset, .parent = 0, .cycles = 0 });
+		call_tree_children.clear();
+		call_stack.assign(1, { .node = 0, .entry_sp = 0x100 });
+		last_counts = nullptr;
+		last_node = 0;
+		Debug::AttachTracer(&profiler);
+	}
+
+
+	void Stop()
+	{
+		if (IsRunning()) {
+			Debug::DetachTracer(&profiler);
+			/* The profiler is only stopped between calls to CPU::Run, when the cycle count is up to date. */
+			Charge(CPU::GetCycleCount());
+			last_counts = nullptr;
+		}
+	}
+
+
+	bool WriteCollapsedStacks(const std::string& path)
+	{
+		std::ofstream file{ path, std::ofstream::out | std::ofstream::binary };
+		if (!file) {
+			return false;
+		}
+		std::vector<std::string> names(call_tree.size());
+		for (size_t i = 0; i < call_tree.size(); ++i) {
+			names[i] = FunctionName(call_tree[i].function);
+		}
+		std::vector<u32> path_nodes;
+		for (u32 node = 0; node < call_tree.size(); ++node) {
+			if (call_tree[node].cycles == 0) {
+				continue;
+			}
+			path_nodes.clear();
+			for (u32 n = node; n != 0; n = call_tree[n].parent) {
+				path_nodes.push_back(n);
+			}
+			file << names[0];
+			for (u32 n : path_nodes | std::views::reverse) {
+				file << ';' << names[n];
+			}
+			file << ' ' << call_tree[node].cycles << '\n';
+		}
+		return bool(file);
+	}
+
+
+	bool WriteFlatProfile(const std::string& path)
+	{
+		std::ofstream file{ path, std::ofstream::out | std::ofstream::binary };
+		if (!file) {
+			return false;
+		}
+		struct Entry
+		{
+			std::string location;
+			Counts counts;
+		};
+		std::vector<Entry> entries;
+		std::vector<Counts> bank_counts((prg_rom.size() + bank_size - 1) / bank_size);
+		Counts outside_prg_rom_counts{};
+		for (size_t offset = 0; offset < prg_rom_counts.size(); ++offset) {
+			const Counts& counts = prg_rom_counts[offset];
+			if (counts.instructions > 0) {
+				entries.push_back({ std::format("{:02X}:{:04X}", offset / bank_size, counts.addr), counts });
+				bank_counts[offset / bank_size].cycles += counts.cycles;
+				bank_counts[offset / bank_size].instructions += counts.instructions;
+			}
+		}
+		for (size_t addr = 0; addr < other_counts.size(); ++addr) {
+			const Counts& counts = other_counts[addr];
+			if (counts.instructions > 0) {
+				entries.push_back({ std::format("--:{:04X}", addr), counts });
+				outside_prg_rom_counts.cycles += counts.cycles;
+				outside_prg_rom_counts.instructions += counts.instructions;
+			}
+		}
+		for (u32 i = 0; i < interrupt_counts.size(); ++i) {
+			if (interrupt_counts[i].instructions > 0) {
+				entries.push_back({ FunctionName(function_interrupt + i), interrupt_counts[i] });
+			}
+		}
+		std::ranges::sort(entries, [](const Entry& lhs, const Entry& rhs) { return lhs.counts.cycles > rhs.counts.cycles; });
+
+		u64 total_cycles = 0, total_instructions = 0, total_interrupts = 0;
+		for (const Entry& entry : entries) {
+			total_cycles += entry.counts.cycles;
+			total_instructions += entry.counts.instructions;
+		}
+		for (const Counts& counts : interrupt_counts) {
+			total_interrupts += counts.instructions;
+		}
+		total_instructions -= total_interrupts;
+		auto percentage = [&](u64 cycles) {
+			return total_cycles > 0 ? 100.0 * cycles / total_cycles : 0.0;
+		};
+		file << std::format("Total: {} cycles, {} instructions, {} interrupts\n\n",
+			total_cycles, total_instructions, total_interrupts);
+		file << std::format("{:<10}{:>14}{:>9}{:>14}\n", "Bank", "Cycles", "%", "Instructions");
+		for (size_t bank = 0; bank < bank_counts.size(); ++bank) {
+			if (bank_counts[bank].instructions > 0) {
+				file << std::format("{:<10}{:>14}{:>9.2f}{:>14}\n", std::format("{:02X}", bank), bank_counts[bank].cycles,
+					percentage(bank_counts[bank].cycles), bank_counts[bank].instructions);
+			}
+		}
+		file << std::format("{:<10}{:>14}{:>9.2f}{:>14}\n\n", "--", outside_prg_rom_counts.cycles,
+			percentage(outside_prg_rom_counts.cycles), outside_prg_rom_counts.instructions);
+		file << std::format("{:<10}{:>14}{:>9}{:>14}\n", "Address", "Cycles", "%", "Instructions");
+		for (const Entry& entry : entries) {
+			file << std::format("{:<10}{:>14}{:>9.2f}{:>14}\n", entry.location, entry.counts.cycles,
+				percentage(entry.counts.cycles), entry.counts.instructions);
+		}
+		return bool(file);
+	}
+
+
+	void CycleProfiler::OnInstruction(const Debug::InstrTrace& instr)
+	{
+		Charge(instr.cycle);
+		if (call_stack.back().entry_sp == -1) {
+			call_stack.back().entry_sp = instr.sp + 3;
+		}
+		Counts& counts = CountsAt(instr.pc);
+		counts.instructions++;
+		counts.addr = instr.pc;
+		last_counts = &counts;
+		last_node = call_stack.back().node;
+
+		switch (instr.opcode) {
+		case 0x00: /* BRK */
+			Call(function_interrupt + u32(CPU::InterruptType::BRK), instr.sp);
+			break;
+		case 0x20: /* JSR */
+			Call(FunctionKey(Bus::Peek(instr.pc + 1) | Bus::Peek(instr.pc + 2) << 8), instr.sp);
+			break;
+		case 0x40: /* RTI */
+			Return(instr.sp + 3);
+			break;
+		case 0x60: /* RTS */
+			Return(instr.sp + 2);
+			break;
+		}
+	}
+
+
+	void CycleProfiler::OnInterrupt(CPU::InterruptType interrupt, u64 cycle)
+	{
+		Charge(cycle);
+		Call(function_interrupt + u32(interrupt), -1);
+		Counts& counts = interrupt_counts[u32(interrupt)];
+		counts.instructions++;
+		last_counts = &counts;
+		last_node = call_stack.back().node;
+	}
+}
\ No newline at end of file
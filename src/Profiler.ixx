@@ -0,0 +1,96 @@
+export module Profiler;
+
+import CPU;
+import Debug;
+
+import NumericalTypes;
+
+import <array>;
+import <optional>;
+import <span>;
+import <string>;
+import <unordered_map>;
+import <vector>;
+
+/* An exact (not sampling) profiler of the cpu. While started, it is attached as a tracer (see Debug::Tracer), and charges
+   the cycles from the start of each instruction to the start of the next one, including those of any DMA it caused, to
+   the instruction; code in PRG ROM is counted by its offset into the ROM, and thus per bank, all other code by its cpu address.
+   JSR, BRK and interrupts also push a frame onto a shadow call stack, and RTS and RTI pop every frame that was entered at
+   or below the stack pointer they restore. This keeps the stack in sync with code that pulls or pushes return addresses
+   itself, e.g. jump tables through RTS. The cycles are also charged to the path of the call tree on the stack, which can
+   be written in the "collapsed stacks" format read by flame graph tools.
+   Idle loops are not skipped while a tracer is attached, so the time spent in them shows up in the profile. */
+namespace Profiler
+{
+	export
+	{
+		bool IsRunning();
+		void Start();
+		/* Detaches the profiler; the counts are kept until the next Start. */
+		void Stop();
+		/* One line per call stack: the functions (entry points), outermost first, separated by ';', and the cycles spent
+		   in the innermost one. */
+		bool WriteCollapsedStacks(const std::string& path);
+		/* The cycles and instructions per 8 KiB PRG ROM bank, and per instruction address. */
+		bool WriteFlatProfile(const std::string& path);
+	}
+
+	struct Counts
+	{
+		u64 cycles;
+		u64 instructions; /* For interrupt_counts: the number of interrupts. */
+		u16 addr; /* The cpu address the code was last executed at. */
+	};
+
+	struct CallTreeNode
+	{
+		u32 function; /* See FunctionKey. */
+		u32 parent;
+		u64 cycles; /* Not including those of the callees. */
+	};
+
+	struct Frame
+	{
+		u32 node;
+		int entry_sp; /* The stack pointer before the return address was pushed; -1 for an interrupt until it is known. */
+	};
+
+	class CycleProfiler : public Debug::Tracer
+	{
+	public:
+		void OnInstruction(const Debug::InstrTrace& instr) override;
+		void OnInterrupt(CPU::InterruptType interrupt, u64 cycle) override;
+	};
+
+	void Call(u32 function, int entry_sp);
+	void Charge(u64 cycle);
+	Counts& CountsAt(u16 addr);
+	u32 FunctionKey(u16 addr);
+	std::string FunctionName(u32 function);
+	std::optional<size_t> GetPrgRomOffset(u16 addr);
+	void Return(int sp);
+
+	/* Functions are identified by the PRG ROM offset of their entry point, or by one of the below. */
+	constexpr u32 function_outside_prg_rom = 0x80000000; /* + cpu address */
+	constexpr u32 function_interrupt = 0xFFFFFF00; /* + CPU::InterruptType */
+	constexpr u32 function_reset = 0xFFFFFFFF; /* The root of the call tree. */
+
+	constexpr size_t bank_size = 0x2000; /* Only for reporting; the smallest PRG bank size of the supported mappers. */
+	constexpr size_t max_call_depth = 256;
+
+	thread_local CycleProfiler profiler;
+
+	thread_local std::span<const u8> prg_rom;
+	thread_local std::vector<Counts> prg_rom_counts; /* Indexed by PRG ROM offset. */
+	thread_local std::vector<Counts> other_counts; /* Code outside of PRG ROM, indexed by cpu address. */
+	thread_local std::array<Counts, 3> interrupt_counts; /* The interrupt sequences, indexed by CPU::InterruptType. */
+
+	thread_local std::vector<CallTreeNode> call_tree;
+	thread_local std::unordered_map<u64, u32> call_tree_children; /* Indexed by the parent node << 32 | the function. */
+	thread_local std::vector<Frame> call_stack;
+
+	/* Of the last instruction or interrupt, which are charged the cycles until the next one starts. */
+	thread_local Counts* last_counts;
+	thread_local u64 last_cycle;
+	thread_local u32 last_node;
+}
\ No newline at end of file
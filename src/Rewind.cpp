@@ -0,0 +1,187 @@
+module Rewind;
+
+import NES;
+
+import <algorithm>;
+import <cstring>;
+
+namespace Rewind
+{
+	/* A delta is a sequence of (number of equal bytes, number of differing bytes, the xor of the differing bytes), with the
+	   counts as LEB128 varints. Runs of fewer than 'min_equal_run' equal bytes are kept in the differing bytes, as they would
+	   take about as much space as two more counts. Trailing equal bytes are not encoded. */
+	constexpr size_t min_equal_run = 4;
+
+
+	void EncodeDelta(std::span<const u8> a, std::span<const u8> b, std::vector<u8>& out)
+	{
+		auto write_count = [&out](size_t count) {
+			while (count >= 0x80) {
+				out.push_back(u8(count | 0x80));
+				count >>= 7;
+			}
+			out.push_back(u8(count));
+		};
+		auto load_u64 = [](const u8* bytes) {
+			u64 value;
+			std::memcpy(&value, bytes, sizeof(u64));
+			return value;
+		};
+
+		out.clear();
+		const size_t size = a.size();
+		size_t i = 0;
+		while (i < size) {
+			const size_t equal_start = i;
+			while (i + 8 <= size && load_u64(&a[i]) == load_u64(&b[i])) {
+				i += 8;
+			}
+			while (i < size && a[i] == b[i]) {
+				++i;
+			}
+			if (i == size) {
+				break;
+			}
+			const size_t diff_start = i;
+			size_t equal_run = 0;
+			while (i < size && equal_run < min_equal_run) {
+				equal_run = a[i] == b[i] ? equal_run + 1 : 0;
+				++i;
+			}
+			i -= equal_run;
+			write_count(diff_start - equal_start);
+			write_count(i - diff_start);
+			for (size_t j = diff_start; j < i; ++j) {
+				out.push_back(a[j] ^ b[j]);
+			}
+		}
+	}
+
+
+	void ApplyDelta(std::span<const u8> delta, std::span<u8> state)
+	{
+		size_t i = 0;
+		auto read_count = [&] {
+			size_t count = 0;
+			for (uint shift = 0; ; shift += 7) {
+				const u8 byte = delta[i++];
+				count |= size_t(byte & 0x7F) << shift;
+				if (!(byte & 0x80)) {
+					return count;
+				}
+			}
+		};
+
+		size_t pos = 0;
+		while (i < delta.size()) {
+			pos += read_count();
+			const size_t diff_size = read_count();
+			for (size_t j = 0; j < diff_size; ++j) {
+				state[pos + j] ^= delta[i + j];
+			}
+			pos += diff_size;
+			i += diff_size;
+		}
+	}
+
+
+	Buffer::Buffer(size_t capacity, uint frame_interval)
+		: frame_interval(std::max(frame_interval, 1u)), ring(capacity)
+	{
+	}
+
+
+	void Buffer::Capture()
+	{
+		newest_is_loaded = false;
+		if (frames_until_capture > 0) {
+			--frames_until_capture;
+			return;
+		}
+		frames_until_capture = frame_interval - 1;
+		Snapshot& previous = states[newest];
+		Snapshot& current = states[newest ^ 1];
+		NES::SaveSnapshot(current);
+		if (!previous.IsEmpty()) {
+			EncodeDelta(previous.GetData(), current.GetData(), delta);
+			Push(delta);
+		}
+		newest ^= 1;
+	}
+
+
+	void Buffer::Clear()
+	{
+		states[0] = states[1] = {};
+		entries.clear();
+		newest_is_loaded = false;
+		frames_until_capture = 0;
+		ring_end = 0;
+		stored_bytes = 0;
+	}
+
+
+	size_t Buffer::GetMemoryUsage() const
+	{
+		return stored_bytes + states[newest].GetData().size();
+	}
+
+
+	size_t Buffer::GetNumStates() const
+	{
+		return states[newest].IsEmpty() ? 0 : entries.size() + 1;
+	}
+
+
+	void Buffer::Push(std::span<const u8> bytes)
+	{
+		auto drop_oldest = [this] {
+			stored_bytes -= entries.front().size;
+			entries.pop_front();
+		};
+
+		if (bytes.size() > ring.size()) {
+			/* The state before this one can not be stored, and neither can any older one, as it is restored through it. */
+			while (!entries.empty()) {
+				drop_oldest();
+			}
+			return;
+		}
+		size_t offset = ring_end;
+		if (offset + bytes.size() > ring.size()) {
+			/* The deltas between the end of the newest one and the end of the ring are the oldest ones. */
+			while (!entries.empty() && entries.front().offset >= ring_end) {
+				drop_oldest();
+			}
+			offset = 0;
+		}
+		while (!entries.empty() && entries.front().offset < offset + bytes.size()
+			&& entries.front().offset + entries.front().size > offset) {
+			drop_oldest();
+		}
+		std::memcpy(ring.data() + offset, bytes.data(), bytes.size());
+		entries.push_back({ offset, bytes.size() });
+		ring_end = offset + bytes.size();
+		stored_bytes += bytes.size();
+	}
+
+
+	bool Buffer::StepBack()
+	{
+		Snapshot& state = states[newest];
+		if (state.IsEmpty()) {
+			return false;
+		}
+		if (newest_is_loaded && !entries.empty()) {
+			const Entry& entry = entries.back();
+			ApplyDelta({ ring.data() + entry.offset, entry.size }, state.GetData());
+			stored_bytes -= entry.size;
+			ring_end = entries.size() > 1 ? entries[entries.size() - 2].offset + entries[entries.size() - 2].size : 0;
+			entries.pop_back();
+		}
+		NES::LoadSnapshot(state);
+		newest_is_loaded = true;
+		frames_until_capture = 0;
+		return true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+export module Rewind;
+
+import Snapshot;
+
+import NumericalTypes;
+
+import <deque>;
+import <span>;
+import <vector>;
+
+/* A history of console states for stepping back in time. Every 'frame_interval' frames, a snapshot is taken (see Snapshot),
+   and the one taken before it is replaced by the xor of the two, which is mostly zeroes (most of the state, i.e. the RAMs,
+   changes little from one frame to the next), compressed by run-length encoding the zeroes. Only the newest state is kept
+   whole; each older one is restored by applying the deltas to it, newest first. The deltas are kept in a ring of a fixed
+   number of bytes, and the oldest ones are dropped to make room for new ones. */
+namespace Rewind
+{
+	export
+	{
+		class Buffer
+		{
+		public:
+			/* 'capacity' is the size in bytes of the ring of compressed deltas. */
+			Buffer(size_t capacity, uint frame_interval = 1);
+
+			/* To be called after every frame (see NES::RunFrame); every 'frame_interval' calls, the state is captured. */
+			void Capture();
+			void Clear();
+			/* Compressed deltas, and the newest state. */
+			size_t GetMemoryUsage() const;
+			size_t GetNumStates() const;
+			/* Loads the newest state captured, and drops it from the history unless no frame has been run since it was
+			   last loaded, in which case the one before it is loaded instead. Returns false if there is no state to load. */
+			bool StepBack();
+
+		private:
+			struct Entry
+			{
+				size_t offset;
+				size_t size;
+			};
+
+			void Push(std::span<const u8> bytes);
+
+			bool newest_is_loaded = false;
+			uint frame_interval;
+			uint frames_until_capture = 0;
+			uint newest = 0; /* Index into 'states'. */
+			size_t ring_end = 0; /* Where the newest delta in 'ring' ends. */
+			size_t stored_bytes = 0;
+			Snapshot states[2]; /* The newest state, and the one being captured. */
+			std::deque<Entry> entries; /* Oldest first. */
+			std::vector<u8> delta;
+			std::vector<u8> ring;
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,188 @@
+export module Snapshot;
+
+import NumericalTypes;
+
+import <algorithm>;
+import <array>;
+import <cstring>;
+import <span>;
+import <type_traits>;
+import <vector>;
+
+/* An in-memory copy of the console state, for saving and restoring it every frame (e.g. for run-ahead; see NES::RunFrameAhead).
+   The components stream their state into it through the same StreamState functions as into a SerializationStream, but
+   every field is a plain memcpy into a buffer which is only allocated on the first save. The size of a primitive (or struct)
+   is known at compile time, so copying one compiles to a move or two instead of a call to memcpy.
+   The buffer starts with a Header. Its version is to be bumped whenever the layout of the state changes, so that a snapshot
+   kept outside of the process (see SetData) is not loaded into a different layout. The layout also depends on the rom, which
+   is identified by its CRC, and on the build (the components' structs are copied as they are in memory), which is not
+   recorded; a snapshot is therefore only loaded if it is exactly as large as one saved by the console loading it. Every read
+   is bounds checked as well, so that a snapshot that is nonetheless malformed cannot make a load read past its end. */
+export class Snapshot
+{
+public:
+	struct Header
+	{
+		std::array<char, 8> magic;
+		u32 version;
+		u32 size; /* Of the whole snapshot, including the header. */
+		u32 rom_crc; /* Of the rom file of the console that saved it (see Cartridge::GetRomCrc). */
+	};
+
+	static constexpr std::array<char, 8> magic = { 'N', 'E', 'S', 'S', 'N', 'A', 'P', '\0' };
+	static constexpr u32 version = 2;
+
+	/* Returns false if the snapshot cannot be loaded (see CanLoad); the state of the console is then left untouched. */
+	bool BeginLoad(u32 rom_crc, size_t expected_size)
+	{
+		if (!CanLoad(rom_crc, expected_size)) {
+			return false;
+		}
+		loading = true;
+		overrun = false;
+		pos = sizeof(Header);
+		return true;
+	}
+
+	void BeginSave()
+	{
+		loading = false;
+		pos = sizeof(Header);
+		if (buffer.size() < pos) {
+			buffer.resize(pos);
+		}
+	}
+
+	/* Returns false unless the snapshot was saved by this version, from a console running the rom with CRC 'rom_crc',
+	   and is 'expected_size' bytes large (see NES::GetSnapshotSize). */
+	bool CanLoad(u32 rom_crc, size_t expected_size) const
+	{
+		if (size < sizeof(Header) || size != expected_size) {
+			return false;
+		}
+		Header header;
+		std::memcpy(&header, buffer.data(), sizeof(Header));
+		return header.magic == magic && header.version == version && header.size == size && header.rom_crc == rom_crc;
+	}
+
+	/* Returns false if a read would have gone past the end of the snapshot, or if not all of it was read. */
+	bool EndLoad()
+	{
+		loading = false;
+		return pos == size && !overrun;
+	}
+
+	void EndSave(u32 rom_crc)
+	{
+		size = pos;
+		const Header header = { magic, version, u32(size), rom_crc };
+		std::memcpy(buffer.data(), &header, sizeof(Header));
+	}
+
+	std::span<u8> GetData()
+	{
+		return { buffer.data(), size };
+	}
+
+	std::span<const u8> GetData() const
+	{
+		return { buffer.data(), size };
+	}
+
+	bool IsEmpty() const
+	{
+		return size == 0;
+	}
+
+	bool IsLoading() const
+	{
+		return loading;
+	}
+
+	/* Replaces the contents with a copy of 'data', e.g. that of GetData written to and read back from a file. Whether it
+	   can be loaded is checked by BeginLoad. */
+	void SetData(std::span<const u8> data)
+	{
+		buffer.assign(data.begin(), data.end());
+		size = data.size();
+	}
+
+	template<typename T, size_t N>
+	void StreamArray(std::array<T, N>& array)
+	{
+		StreamBytes(array.data(), sizeof(array));
+	}
+
+	template<typename T>
+	T StreamBitfield(T value)
+	{
+		StreamBytes<sizeof(T)>(&value);
+		return value;
+	}
+
+	template<typename T>
+	void StreamPrimitive(T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		StreamBytes<sizeof(T)>(&value);
+	}
+
+	/* The size of the vector is not stored; it is fixed by the rom (e.g. PRG RAM). */
+	template<typename T>
+	void StreamVector(std::vector<T>& vector)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		StreamBytes(vector.data(), vector.size() * sizeof(T));
+	}
+
+private:
+	template<size_t num_bytes>
+	void StreamBytes(void* bytes)
+	{
+		if (loading) {
+			if (num_bytes > size - pos) {
+				Overrun();
+				return;
+			}
+			std::memcpy(bytes, buffer.data() + pos, num_bytes);
+		}
+		else {
+			if (pos + num_bytes > buffer.size()) {
+				buffer.resize(std::max(pos + num_bytes, 2 * buffer.size()));
+			}
+			std::memcpy(buffer.data() + pos, bytes, num_bytes);
+		}
+		pos += num_bytes;
+	}
+
+	void StreamBytes(void* bytes, size_t num_bytes)
+	{
+		if (loading) {
+			if (num_bytes > size - pos) {
+				Overrun();
+				return;
+			}
+			std::memcpy(bytes, buffer.data() + pos, num_bytes);
+		}
+		else {
+			if (pos + num_bytes > buffer.size()) {
+				buffer.resize(std::max(pos + num_bytes, 2 * buffer.size()));
+			}
+			std::memcpy(buffer.data() + pos, bytes, num_bytes);
+		}
+		pos += num_bytes;
+	}
+
+	/* Makes this and every later read of the load fail; the destination is left as it is. */
+	void Overrun()
+	{
+		overrun = true;
+		pos = size;
+	}
+
+	bool loading = false;
+	bool overrun = false;
+	size_t pos = 0;
+	size_t size = 0;
+	std::vector<u8> buffer;
+};
\ No newline at end of file
@@ -1,19 +1,168 @@
 module System;
 
 import APU;
+import Cartridge;
+import CPU;
 import PPU;
+import Snapshot;
+
+import <algorithm>;
 
 namespace System
 {
+	void CatchUp()
+	{
+		/* While updates are deferred, the APU and PPU cannot affect each other or the cpu (see ComputeCpuCyclesUntilNextEvent),
+		   so each of them can be run for all deferred cycles at once. */
+		if (deferred_cpu_cycles > 0) {
+			auto update_apu = [] {
+				for (uint i = 0; i < deferred_cpu_cycles; ++i) {
+					APU::Update();
+				}
+			};
+			auto update_ppu = [] {
+				PPU::Update(deferred_cpu_cycles);
+			};
+			if constexpr (profile_subsystems) {
+				auto t0 = std::chrono::steady_clock::now();
+				update_apu();
+				auto t1 = std::chrono::steady_clock::now();
+				update_ppu();
+				auto t2 = std::chrono::steady_clock::now();
+				apu_host_time += t1 - t0;
+				ppu_host_time += t2 - t1;
+			}
+			else {
+				update_apu();
+				update_ppu();
+			}
+			deferred_cpu_cycles = 0;
+		}
+		/* The cpu may be about to access a component, so the next event cannot be predicted. */
+		cpu_cycles_until_next_event = 0;
+	}
+
+
+	void DeferCpuCycles(uint num_cpu_cycles)
+	{
+		/* Lets cpu cycles pass without the cpu accessing anything; at most GetCpuCyclesUntilNextEvent() of them. */
+		deferred_cpu_cycles += num_cpu_cycles;
+	}
+
+
+	uint ComputeCpuCyclesUntilNextEvent()
+	{
+		if (!CPU::InterruptInputsAreSettled()) {
+			return 0;
+		}
+		return std::min({ APU::GetCpuCyclesUntilNextEvent(), Cartridge::GetCpuCyclesUntilNextEvent(), PPU::GetCpuCyclesUntilNextEvent() });
+	}
+
+
+	u64 GetApuHostTimeNs()
+	{
+		return HostTimeToNs(apu_host_time);
+	}
+
+
+	uint GetCpuCyclesUntilNextEvent()
+	{
+		/* The number of cpu cycles from now during which no component can affect the cpu, unless it is accessed. */
+		if constexpr (defer_component_updates) {
+			return cpu_cycles_until_next_event - deferred_cpu_cycles;
+		}
+		else {
+			return 0;
+		}
+	}
+
+
+	uint GetCpuCyclesUntilPpuStatusChange()
+	{
+		/* The PPU may be behind the cpu by the deferred cycles. */
+		const uint ppu_cpu_cycles = PPU::GetCpuCyclesUntilStatusChange();
+		return ppu_cpu_cycles > deferred_cpu_cycles ? ppu_cpu_cycles - deferred_cpu_cycles : 0;
+	}
+
+
+	u64 GetPpuHostTimeNs()
+	{
+		return HostTimeToNs(ppu_host_time);
+	}
+
+
+	u64 HostTimeToNs(std::chrono::steady_clock::duration time)
+	{
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+		return ns > 0 ? ns : 0;
+	}
+
+
+	void ResetHostTimers()
+	{
+		profile_sample_counter = 0;
+		apu_host_time = ppu_host_time = {};
+		/* Measure the cost of reading the clock, so that it can be subtracted from every sample. */
+		constexpr int num_clock_reads = 1024;
+		auto t0 = std::chrono::steady_clock::now();
+		for (int i = 0; i < num_clock_reads; ++i) {
+			(void)std::chrono::steady_clock::now();
+		}
+		clock_read_overhead = (std::chrono::steady_clock::now() - t0) / num_clock_reads;
+	}
+
+
+	void ResetScheduler()
+	{
+		component_update_depth = 0;
+		cpu_cycles_until_next_event = 0;
+		deferred_cpu_cycles = 0;
+	}
+
+
 	void StepAllComponentsButCpu()
 	{
-		APU::Update();
-		PPU::Update();
+		if constexpr (defer_component_updates) {
+			if (deferred_cpu_cycles < cpu_cycles_until_next_event) {
+				++deferred_cpu_cycles;
+				return;
+			}
+			CatchUp();
+		}
+		++component_update_depth;
+		UpdateComponents();
+		if (--component_update_depth == 0) {
+			cpu_cycles_until_next_event = ComputeCpuCyclesUntilNextEvent();
+		}
 	}
 
 
-	void StreamState(SerializationStream& stream)
+	template<typename Stream>
+	void StreamState(Stream& stream)
 	{
 		stream.StreamPrimitive(standard);
 	}
+
+	template void StreamState(SerializationStream&);
+	template void StreamState(Snapshot&);
+
+
+	void UpdateComponents()
+	{
+		if constexpr (profile_subsystems) {
+			if (++profile_sample_counter == profile_sample_interval) {
+				profile_sample_counter = 0;
+				auto t0 = std::chrono::steady_clock::now();
+				APU::Update();
+				auto t1 = std::chrono::steady_clock::now();
+				PPU::Update();
+				auto t2 = std::chrono::steady_clock::now();
+				apu_host_time += (t1 - t0 - clock_read_overhead) * profile_sample_interval;
+				ppu_host_time += (t2 - t1 - clock_read_overhead) * profile_sample_interval;
+				return;
+			}
+		}
+		APU::Update();
+		PPU::Update();
+	}
 }
\ No newline at end of file
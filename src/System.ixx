@@ -6,11 +6,34 @@ import NumericalTypes;
 import SerializationStream;
 
 import <array>;
+import <chrono>;
 
 export namespace System
 {
+	void CatchUp();
+	void DeferCpuCycles(uint num_cpu_cycles);
+	u64 GetApuHostTimeNs();
+	uint GetCpuCyclesUntilNextEvent();
+	uint GetCpuCyclesUntilPpuStatusChange();
+	u64 GetPpuHostTimeNs();
+	void ResetHostTimers();
+	void ResetScheduler();
 	void StepAllComponentsButCpu();
-	void StreamState(SerializationStream& stream);
+	template<typename Stream> void StreamState(Stream& stream);
+
+	/* If set, the APU and PPU are not stepped on every cpu cycle. Instead, they are caught up in one go once the cpu accesses them
+	   (or the cartridge), or when they are predicted to raise an interrupt or otherwise affect the cpu. Clear to step them eagerly. */
+	constexpr bool defer_component_updates = true;
+
+	/* Host time spent in the APU and PPU is sampled on every 'profile_sample_interval'th eagerly stepped cpu cycle only, as reading the clock
+	   on every cycle would cost more than the components themselves. Deferred cycles are timed in full.
+	   Define NES_PROFILE_SUBSYSTEMS to enable (see NESBench). */
+#ifdef NES_PROFILE_SUBSYSTEMS
+	constexpr bool profile_subsystems = true;
+#else
+	constexpr bool profile_subsystems = false;
+#endif
+	constexpr uint profile_sample_interval = 64;
 
 	struct Standard
 	{
@@ -23,6 +46,7 @@ export namespace System
 		/* ppu */
 		bool oam_can_be_written_to_during_forced_blanking;
 		bool pre_render_line_is_one_dot_shorter_on_every_other_frame;
+		bool red_and_green_emphasis_bits_are_swapped; /* PPUMASK bits 5 and 6 */
 		float ppu_dots_per_cpu_cycle;
 		int nmi_scanline;
 		int num_scanlines;
@@ -37,6 +61,7 @@ export namespace System
 		.cpu_cycles_per_sec = 1789773,
 		.oam_can_be_written_to_during_forced_blanking = true,
 		.pre_render_line_is_one_dot_shorter_on_every_other_frame = true,
+		.red_and_green_emphasis_bits_are_swapped = false,
 		.ppu_dots_per_cpu_cycle = 3.0f,
 		.nmi_scanline = 241,
 		.num_scanlines = 262,
@@ -51,6 +76,7 @@ export namespace System
 		.cpu_cycles_per_sec = 1662607,
 		.oam_can_be_written_to_during_forced_blanking = false,
 		.pre_render_line_is_one_dot_shorter_on_every_other_frame = false,
+		.red_and_green_emphasis_bits_are_swapped = true,
 		.ppu_dots_per_cpu_cycle = 3.2f,
 		.nmi_scanline = 240,
 		.num_scanlines = 312,
@@ -65,6 +91,7 @@ export namespace System
 		.cpu_cycles_per_sec = 1662607,
 		.oam_can_be_written_to_during_forced_blanking = true,
 		.pre_render_line_is_one_dot_shorter_on_every_other_frame = false,
+		.red_and_green_emphasis_bits_are_swapped = true,
 		.ppu_dots_per_cpu_cycle = 3.0f,
 		.nmi_scanline = 290,
 		.num_scanlines = 312,
@@ -72,5 +99,22 @@ export namespace System
 		.num_visible_scanlines = 239
 	};
 
-	Standard standard = standard_ntsc;
+	thread_local Standard standard = standard_ntsc;
+}
+
+
+namespace System
+{
+	uint ComputeCpuCyclesUntilNextEvent();
+	u64 HostTimeToNs(std::chrono::steady_clock::duration time);
+	void UpdateComponents();
+
+	thread_local uint component_update_depth; /* > 1 if the CPU is stalled by the APU, which in turn calls StepAllComponentsButCpu */
+	thread_local uint cpu_cycles_until_next_event; /* Counted from when the components were last stepped */
+	thread_local uint deferred_cpu_cycles; /* Cpu cycles for which the APU and PPU have not been stepped yet */
+	thread_local uint profile_sample_counter;
+
+	thread_local std::chrono::steady_clock::duration apu_host_time;
+	thread_local std::chrono::steady_clock::duration clock_read_overhead;
+	thread_local std::chrono::steady_clock::duration ppu_host_time;
 }
\ No newline at end of file
@@ -0,0 +1,222 @@
+module;
+
+/* The ring of a trace being recorded to a file is a shared mapping of the file, so that its contents outlive the process. */
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+module TraceFile;
+
+import Debug;
+
+import <algorithm>;
+import <bit>;
+import <format>;
+import <fstream>;
+import <iterator>;
+import <new>;
+import <unordered_map>;
+import <vector>;
+
+namespace TraceFile
+{
+	Buffer::~Buffer()
+	{
+		Release();
+	}
+
+
+	bool Buffer::Allocate(size_t capacity)
+	{
+		Release();
+		capacity = std::bit_ceil(std::max(capacity, size_t(1)));
+		memory.reset(new (std::nothrow) u8[sizeof(Header) + capacity * sizeof(Record)]);
+		if (!memory) {
+			return false;
+		}
+		header = new (memory.get()) Header{ magic, version, sizeof(Record), capacity, 0, 0 };
+		slots = reinterpret_cast<Slot*>(memory.get() + sizeof(Header));
+		index_mask = capacity - 1;
+		return true;
+	}
+
+
+	bool Buffer::Map(const std::string& path, size_t capacity)
+	{
+		Release();
+		capacity = std::bit_ceil(std::max(capacity, size_t(1)));
+		const size_t size = sizeof(Header) + capacity * sizeof(Record);
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, DWORD(u64(size) >> 32), DWORD(size), nullptr);
+		void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : nullptr;
+		if (view == nullptr) {
+			if (mapping != nullptr) {
+				CloseHandle(mapping);
+			}
+			CloseHandle(file);
+			return false;
+		}
+		file_handle = file;
+		mapping_handle = mapping;
+#else
+		int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd == -1) {
+			return false;
+		}
+		void* view = ftruncate(fd, off_t(size)) == 0
+			? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+			: MAP_FAILED;
+		close(fd); /* The mapping keeps the file open. */
+		if (view == MAP_FAILED) {
+			return false;
+		}
+#endif
+		mapped_size = size;
+		header = new (view) Header{ magic, version, sizeof(Record), capacity, 0, 0 };
+		slots = reinterpret_cast<Slot*>(static_cast<u8*>(view) + sizeof(Header));
+		index_mask = capacity - 1;
+		return true;
+	}
+
+
+	void Buffer::Release()
+	{
+		if (mapped_size > 0) {
+#ifdef _WIN32
+			UnmapViewOfFile(header);
+			CloseHandle(mapping_handle);
+			CloseHandle(file_handle);
+			file_handle = mapping_handle = nullptr;
+#else
+			munmap(header, mapped_size);
+#endif
+			mapped_size = 0;
+		}
+		memory.reset();
+		header = nullptr;
+		slots = nullptr;
+		index_mask = 0;
+	}
+
+
+	bool Buffer::Save(const std::string& path) const
+	{
+		if (header == nullptr) {
+			return false;
+		}
+		/* Records may be pushed while the ring is copied. Those overwritten meanwhile, including by a push that is still in
+		   progress after the copy, are recognized by the record count after the copy, and dropped. Seeing any word of a push
+		   during the copy implies seeing the count stored before it (see Push), once past the acquire fence. */
+		const u64 capacity = index_mask + 1;
+		const u64 end = std::atomic_ref{ header->num_records }.load(std::memory_order_acquire);
+		/* The cycle of record end - 1, or of a record pushed since; the former is found below by walking back from it. */
+		const u64 newest_cycle = std::atomic_ref{ header->last_cycle }.load(std::memory_order_relaxed);
+		const u64 begin = end > capacity ? end - capacity : 0;
+		std::vector<Record> copy(end - begin);
+		for (u64 i = begin; i < end; ++i) {
+			Slot& slot = slots[i & index_mask];
+			copy[i - begin] = std::bit_cast<Record>(Slot{
+				std::atomic_ref{ slot[0] }.load(std::memory_order_relaxed),
+				std::atomic_ref{ slot[1] }.load(std::memory_order_relaxed) });
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const u64 end_after_copy = std::atomic_ref{ header->num_records }.load(std::memory_order_relaxed);
+		if (end_after_copy + 1 - begin > capacity) {
+			const u64 num_overwritten = std::min(end_after_copy + 1 - capacity - begin, u64(copy.size()));
+			copy.erase(copy.begin(), copy.begin() + num_overwritten);
+		}
+		/* Records are less than 2^32 cycles apart (see Record). */
+		const u64 last_cycle = copy.empty() ? newest_cycle : newest_cycle - u32(u32(newest_cycle) - copy.back().cycle);
+
+		std::ofstream file{ path, std::ofstream::out | std::ofstream::binary };
+		if (!file) {
+			return false;
+		}
+		Header saved_header{ magic, version, sizeof(Record), capacity, copy.size(), last_cycle };
+		file.write(reinterpret_cast<const char*>(&saved_header), sizeof(Header));
+		file.write(reinterpret_cast<const char*>(copy.data()), copy.size() * sizeof(Record));
+		return bool(file);
+	}
+
+
+	bool Format(const std::string& trace_path, std::ostream& out)
+	{
+		std::ifstream file{ trace_path, std::ifstream::in | std::ifstream::binary };
+		Header header;
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(Header)) || header.magic != magic ||
+			header.version != version || header.record_size != sizeof(Record) || header.capacity == 0) {
+			return false;
+		}
+		std::vector<Record> ring(std::min(header.num_records, header.capacity));
+		if (!file.read(reinterpret_cast<char*>(ring.data()), ring.size() * sizeof(Record))) {
+			return false;
+		}
+
+		/* Put the records in order, and reconstruct the upper bits of their cycle counts, from the last one backwards. */
+		const u64 begin = header.num_records - ring.size();
+		std::vector<Record> records(ring.size());
+		for (u64 i = 0; i < ring.size(); ++i) {
+			records[i] = ring[(begin + i) % header.capacity];
+		}
+		std::vector<u64> cycles(records.size());
+		u64 cycle = header.last_cycle;
+		u32 next_cycle_low = u32(header.last_cycle);
+		for (size_t i = records.size(); i-- > 0; ) {
+			cycle -= u32(next_cycle_low - records[i].cycle);
+			cycles[i] = cycle;
+			next_cycle_low = records[i].cycle;
+		}
+
+		/* Hot code is disassembled once; the key is the address and the bytes of the instruction. */
+		std::unordered_map<u64, std::string> disassembly;
+		std::string text;
+		for (size_t i = 0; i < records.size(); ++i) {
+			const Record& r = records[i];
+			switch (r.type) {
+			case RecordType::Instruction: {
+				const u64 key = r.addr | u64(r.data) << 16 | u64(r.operands[0]) << 24 | u64(r.operands[1]) << 32;
+				auto [instr_disassembly, inserted] = disassembly.try_emplace(key);
+				if (inserted) {
+					instr_disassembly->second = Debug::Disassemble(r.addr, r.data, r.operands);
+				}
+				const Debug::InstrTrace instr = {
+					.cycle = cycles[i], .pc = r.addr, .opcode = r.data, .a = r.a, .x = r.x, .y = r.y, .p = r.p, .sp = r.sp
+				};
+				text += Debug::FormatTraceLine(instr, r.operands, instr_disassembly->second);
+				text += '\n';
+				break;
+			}
+			case RecordType::IoRead:
+				std::format_to(std::back_inserter(text), "IO; {:04X} => {:02X}\n", r.addr, r.data);
+				break;
+			case RecordType::IoWrite:
+				std::format_to(std::back_inserter(text), "IO; {:04X} <= {:02X}\n", r.addr, r.data);
+				break;
+			case RecordType::Interrupt:
+				std::format_to(std::back_inserter(text), "Interrupt; {}\n",
+					r.data == 0 ? "BRK" : r.data == 1 ? "IRQ" : "NMI");
+				break;
+			case RecordType::Dma:
+				std::format_to(std::back_inserter(text), "DMA started from {:04X}\n", r.addr);
+				break;
+			}
+			if (text.size() >= 1 << 20) {
+				out << text;
+				text.clear();
+			}
+		}
+		out << text;
+		return bool(out);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,105 @@
+export module TraceFile;
+
+import NumericalTypes;
+
+import <array>;
+import <atomic>;
+import <bit>;
+import <memory>;
+import <ostream>;
+import <string>;
+
+/* Binary execution traces. A trace file is a Header followed by a ring of fixed-size Records, which is either the buffer
+   being recorded to, mapped into memory, or a snapshot of one written by Buffer::Save. Format converts one to text. */
+namespace TraceFile
+{
+	export
+	{
+		enum class RecordType : u8 {
+			Instruction, IoRead, IoWrite, Interrupt, Dma
+		};
+
+		struct Header
+		{
+			std::array<char, 8> magic;
+			u32 version;
+			u32 record_size;
+			u64 capacity; /* Number of records in the ring. */
+			u64 num_records; /* Number of records pushed so far; the ring holds the last min(num_records, capacity) of them. */
+			u64 last_cycle; /* Full cycle count of the last record pushed. */
+		};
+
+		/* Records only hold the low 32 bits of the cpu cycle count; the upper bits are reconstructed from Header::last_cycle,
+		   walking backwards through the records. This assumes that consecutive records are less than 2^32 cycles (40 minutes)
+		   apart. I/O accesses and DMA carry the cycle of the last instruction or interrupt. */
+		struct Record
+		{
+			u32 cycle;
+			u16 addr; /* Instruction: pc. IoRead/IoWrite: register address. Dma: source address. */
+			RecordType type;
+			u8 data; /* Instruction: opcode. IoRead/IoWrite: value. Interrupt: CPU::InterruptType. */
+			std::array<u8, 2> operands; /* Instruction: the two bytes following the opcode. */
+			u8 a, x, y, p, sp; /* Instruction: the registers before it was executed. */
+			u8 padding;
+		};
+
+		static_assert(sizeof(Record) == 16);
+
+		/* A ring of records, written to by the thread running the emulator. Another thread may take a snapshot (Save) at any
+		   time without locking, e.g. from a crash handler. The ring is a seqlock of sorts: a record is written as two relaxed
+		   atomic words, and published by a release store of the record count, which Save reads again after the copy to drop
+		   the records that were overwritten meanwhile. On x86, all of these are plain stores. */
+		class Buffer
+		{
+		public:
+			Buffer() = default;
+			~Buffer();
+
+			Buffer(const Buffer&) = delete;
+			Buffer& operator=(const Buffer&) = delete;
+
+			/* Allocates a ring of 'capacity' records (rounded up to a power of two) in memory. */
+			bool Allocate(size_t capacity);
+			bool IsOpen() const { return header != nullptr; }
+			/* Maps a ring of 'capacity' records (rounded up to a power of two) onto the file at 'path', which is created or
+			   truncated. The file is then always a valid trace, including after the process has crashed. */
+			bool Map(const std::string& path, size_t capacity);
+			/* Appends a record, overwriting the oldest one if the ring is full. 'cycle' is the full cycle count of the record. */
+			void Push(const Record& record, u64 cycle)
+			{
+				const u64 index = header->num_records;
+				/* Orders the stores below after the count store of the previous push, as seen by Save. */
+				std::atomic_thread_fence(std::memory_order_release);
+				const Slot words = std::bit_cast<Slot>(record);
+				Slot& slot = slots[index & index_mask];
+				std::atomic_ref{ slot[0] }.store(words[0], std::memory_order_relaxed);
+				std::atomic_ref{ slot[1] }.store(words[1], std::memory_order_relaxed);
+				std::atomic_ref{ header->last_cycle }.store(cycle, std::memory_order_relaxed);
+				std::atomic_ref{ header->num_records }.store(index + 1, std::memory_order_release);
+			}
+			void Release();
+			/* Writes the records currently in the ring, oldest first, as a trace file. */
+			bool Save(const std::string& path) const;
+
+		private:
+			/* A record, as the words it is written and read as. */
+			using Slot = std::array<u64, 2>;
+			static_assert(sizeof(Slot) == sizeof(Record) && sizeof(Header) % alignof(Slot) == 0);
+
+			Header* header = nullptr;
+			Slot* slots = nullptr;
+			u64 index_mask = 0;
+			std::unique_ptr<u8[]> memory; /* Set if the ring was allocated rather than mapped. */
+			size_t mapped_size = 0;
+			void* file_handle = nullptr; /* Windows only: the handles of the file and of its mapping. */
+			void* mapping_handle = nullptr;
+		};
+
+		/* Writes the trace at 'trace_path' as text, one line per record; instructions are formatted like the nestest log
+		   (see Debug::FormatTraceLine). */
+		bool Format(const std::string& trace_path, std::ostream& out);
+	}
+
+	constexpr std::array<char, 8> magic = { 'N', 'E', 'S', 'T', 'R', 'A', 'C', 'E' };
+	constexpr u32 version = 1;
+}
\ No newline at end of file
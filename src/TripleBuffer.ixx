@@ -0,0 +1,83 @@
+export module TripleBuffer;
+
+import NumericalTypes;
+
+import <array>;
+import <atomic>;
+import <span>;
+
+/* Three buffers handed between a producer thread and a consumer thread without locking or copying: the producer fills the
+   back buffer and publishes it, and the consumer acquires the most recently published buffer as its front buffer. The
+   third buffer (the middle one) holds the latest published buffer until it is acquired, or until it is replaced by a newer
+   one. The two sides thus never block each other and never touch the same buffer; the producer overwrites frames that the
+   consumer did not get to, and the consumer keeps its front buffer until a newer one has been published.
+   The index of the middle buffer and whether it is newer than the front buffer are kept in one atomic byte, through which
+   each side swaps its own buffer with the middle one. */
+export template<typename T>
+class TripleBuffer
+{
+public:
+	/* Consumer: makes the most recently published buffer the front buffer. Returns false if none has been published since
+	   the last call, in which case the front buffer is unchanged. */
+	bool Acquire()
+	{
+		u8 old_state = state.load(std::memory_order_relaxed);
+		do {
+			if (!(old_state & fresh_bit)) {
+				return false;
+			}
+		} while (!state.compare_exchange_weak(old_state, u8(front | old_state & closed_bit), std::memory_order_acq_rel, std::memory_order_relaxed));
+		front = old_state & index_mask;
+		return true;
+	}
+
+	/* Makes WaitForPublish return false until Open is called, e.g. to stop the consumer thread. */
+	void Close()
+	{
+		state.fetch_or(closed_bit, std::memory_order_release);
+		state.notify_all();
+	}
+
+	T& GetBack() { return buffers[back]; }
+
+	/* All three buffers, e.g. to resize them. Only while neither side is using them. */
+	std::span<T, 3> GetBuffers() { return buffers; }
+
+	T& GetFront() { return buffers[front]; } /* Only touched by the consumer. */
+
+	void Open()
+	{
+		state.fetch_and(u8(~closed_bit), std::memory_order_relaxed);
+	}
+
+	/* Producer: publishes the back buffer, and takes over the middle one as the new back buffer. */
+	void Publish()
+	{
+		u8 old_state = state.load(std::memory_order_relaxed);
+		while (!state.compare_exchange_weak(old_state, u8(back | fresh_bit | old_state & closed_bit), std::memory_order_acq_rel,
+			std::memory_order_relaxed)) {}
+		back = old_state & index_mask;
+		state.notify_one();
+	}
+
+	/* Consumer: blocks until a buffer has been published that has not been acquired. Returns false if closed. */
+	bool WaitForPublish()
+	{
+		u8 current_state = state.load(std::memory_order_acquire);
+		while (!(current_state & (fresh_bit | closed_bit))) {
+			state.wait(current_state, std::memory_order_acquire);
+			current_state = state.load(std::memory_order_acquire);
+		}
+		return !(current_state & closed_bit);
+	}
+
+private:
+	static constexpr u8 index_mask = 3;
+	static constexpr u8 fresh_bit = 4;
+	static constexpr u8 closed_bit = 8;
+
+	std::array<T, 3> buffers;
+	u8 back = 0; /* Only touched by the producer. */
+	u8 front = 1; /* Only touched by the consumer. */
+	std::atomic<u8> state = 2; /* Bits 1-0: index of the middle buffer, bit 2: fresh, bit 3: closed. */
+};
\ No newline at end of file
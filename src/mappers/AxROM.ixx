@@ -5,6 +5,7 @@ import MapperProperties;
 
 import NumericalTypes;
 import SerializationStream;
+import Snapshot;
 
 import <array>;
 import <vector>;
@@ -15,6 +16,11 @@ public:
 	AxROM(std::vector<u8> chr_prg_rom, MapperProperties properties) :
 		BaseMapper(chr_prg_rom, MutateProperties(properties)) {}
 
+	void MapPRG() override
+	{
+		MapPRGROM(0x8000, 0x8000, prg_bank * 0x8000);
+	};
+
 	u8 ReadPRG(u16 addr) override
 	{
 		if (addr <= 0x7FFF) {
@@ -31,18 +37,24 @@ public:
 		if (addr >= 0x8000) {
 			prg_bank = (data & 0x07) % properties.num_prg_rom_banks; /* Select 32 KiB PRG ROM bank */
 			vram_page = data & 0x10;
+			MapPRG();
 		}
 	};
 
-	u8 ReadCHR(u16 addr) override
+	std::size_t GetPhysicalCHRAddress(u16 addr) const override
 	{
 		// PPU $0000-$1FFF: 8 KiB RAM (not bank switched)
-		return chr[addr];
+		return addr;
+	};
+
+	u8 ReadCHR(u16 addr) override
+	{
+		return chr[GetPhysicalCHRAddress(addr)];
 	};
 
 	void WriteCHR(u16 addr, u8 data) override
 	{
-		chr[addr] = data;
+		WriteCHRRAM(GetPhysicalCHRAddress(addr), data);
 	};
 
 	const std::array<int, 4>& GetNametableMap() const override
@@ -56,11 +68,22 @@ public:
 	};
 
 	virtual void StreamState(SerializationStream& stream) override
+	{
+		StreamRegisters(stream);
+	};
+
+	virtual void StreamState(Snapshot& snapshot) override
+	{
+		StreamRegisters(snapshot);
+	};
+
+	template<typename Stream>
+	void StreamRegisters(Stream& stream)
 	{
 		BaseMapper::StreamState(stream);
 		stream.StreamPrimitive(vram_page);
 		prg_bank = stream.StreamBitfield(prg_bank);
-	};
+	}
 
 protected:
 	bool vram_page = 0;
@@ -1,5 +1,7 @@
 module BaseMapper;
 
+import Bus;
+
 BaseMapper::BaseMapper(std::vector<u8> chr_prg_rom, MapperProperties properties) : properties(properties)
 {
 	/* These must be calculated here, and cannot be part of the properties passed to the submapper constructor,
@@ -28,6 +30,18 @@ BaseMapper::BaseMapper(std::vector<u8> chr_prg_rom, MapperProperties properties)
 	for (auto& nametable_arr : nametable_ram) {
 		nametable_arr.fill(0x00);
 	}
+	DecodeCHR();
+}
+
+
+void BaseMapper::DecodeCHR()
+{
+	chr_rows.resize(chr.size() / 2);
+	for (std::size_t tile_addr = 0; tile_addr + 16 <= chr.size(); tile_addr += 16) {
+		for (std::size_t row = 0; row < 8; ++row) {
+			chr_rows[tile_addr / 2 + row] = DecodeCHRRow(chr[tile_addr + row], chr[tile_addr + row + 8]);
+		}
+	}
 }
 
 
@@ -68,6 +82,29 @@ void BaseMapper::WritePRGRAMToDisk() const
 }
 
 
+/* Banks reaching outside of PRG RAM/ROM are left to the slow path, where the mapper decides what happens. */
+void BaseMapper::MapPRGRAM(u16 addr, std::size_t size, std::size_t offset)
+{
+	if (offset + size <= prg_ram.size()) {
+		Bus::MapPages(addr, uint(size), prg_ram.data() + offset, true);
+	}
+	else {
+		Bus::UnmapPages(addr, uint(size));
+	}
+}
+
+
+void BaseMapper::MapPRGROM(u16 addr, std::size_t size, std::size_t offset)
+{
+	if (offset + size <= prg_rom.size()) {
+		Bus::MapPages(addr, uint(size), prg_rom.data() + offset, false);
+	}
+	else {
+		Bus::UnmapPages(addr, uint(size));
+	}
+}
+
+
 u8 BaseMapper::ReadNametableRAM(u16 addr)
 {
 	int page = GetNametablePage(addr);
@@ -145,10 +182,40 @@ int BaseMapper::GetNametablePage(u16 addr) const
 
 
 void BaseMapper::StreamState(SerializationStream& stream)
+{
+	StreamMemory(stream);
+}
+
+
+void BaseMapper::StreamState(Snapshot& snapshot)
+{
+	StreamMemory(snapshot);
+}
+
+
+template<typename Stream>
+void BaseMapper::StreamMemory(Stream& stream)
 {
 	stream.StreamArray(nametable_ram);
 	stream.StreamVector(prg_ram);
 	if (properties.has_chr_ram) {
 		stream.StreamVector(chr);
+		/* Saving snapshots is frequent (e.g. for rewinding), so the rows are decoded again only when one is loaded. */
+		if constexpr (std::is_same_v<Stream, Snapshot>) {
+			if (stream.IsLoading()) {
+				DecodeCHR();
+			}
+		}
+		else {
+			DecodeCHR();
+		}
 	}
+}
+
+
+void BaseMapper::WriteCHRRAM(std::size_t physical_addr, u8 data)
+{
+	chr[physical_addr] = data;
+	const std::size_t low_plane_addr = physical_addr & ~std::size_t(8);
+	chr_rows[low_plane_addr >> 4 << 3 | low_plane_addr & 7] = DecodeCHRRow(chr[low_plane_addr], chr[low_plane_addr | 8]);
 }
\ No newline at end of file
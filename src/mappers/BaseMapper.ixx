@@ -4,8 +4,12 @@ import MapperProperties;
 
 import NumericalTypes;
 import SerializationStream;
+import Snapshot;
 
 import <array>;
+import <limits>;
+import <span>;
+import <type_traits>;
 import <vector>;
 
 export class BaseMapper
@@ -13,21 +17,63 @@ export class BaseMapper
 public:
 	BaseMapper(std::vector<u8> chr_prg_rom, MapperProperties properties);
 
-	/* This function should always be called from the derived classes' 'StreamState' functions. */
+	/* These functions should always be called from the derived classes' 'StreamState' functions. */
 	virtual void StreamState(SerializationStream& stream);
+	virtual void StreamState(Snapshot& snapshot);
+
+	/* The row of eight pixels of a pattern table tile with the bit planes 'low' and 'high', as 2-bit colour ids, with the
+	   leftmost pixel in bits 15-14. */
+	static constexpr u16 DecodeCHRRow(u8 low, u8 high)
+	{
+		auto spread_to_even_bits = [](u16 bits) {
+			bits = (bits | bits << 4) & 0x0F0F;
+			bits = (bits | bits << 2) & 0x3333;
+			return u16((bits | bits << 1) & 0x5555);
+		};
+		return u16(spread_to_even_bits(low) | spread_to_even_bits(high) << 1);
+	}
 
 	virtual void ClockIRQ() {};
+	/* Cpu cycles for which the mapper is guaranteed not to change the IRQ line by itself (e.g. through PPU A12 clocking). */
+	virtual uint GetCpuCyclesUntilNextEvent() const { return std::numeric_limits<uint>::max(); };
+	/* The offset into 'chr' of the byte at PPU address 'addr' ($0000-$1FFF) with the current banking. Banks are at least
+	   1 KiB large, so bits 3-0 (the bit plane and the row of a tile) are those of 'addr'. */
+	virtual std::size_t GetPhysicalCHRAddress(u16 addr) const = 0;
+	std::span<const u8> GetPrgRom() const { return prg_rom; }
+	/* Maps the currently selected PRG ROM and RAM banks into the bus page table. Must be called whenever they change.
+	   Pages that are not mapped are accessed through ReadPRG/WritePRG. */
+	virtual void MapPRG() {};
 	virtual u8 ReadPRG(u16 addr) = 0;
 	virtual u8 ReadCHR(u16 addr) = 0;
 	virtual void WritePRG(u16 addr, u8 data) {};
 	virtual void WriteCHR(u16 addr, u8 data) {};
 
+	/* The row of the tile at PPU address 'addr' (of either bit plane) decoded by DecodeCHRRow, from a cache of the decoded rows
+	   of all of CHR, by physical address. For callers that know the concrete mapper type. */
+	template<typename Mapper>
+	u16 ReadCHRRow(u16 addr) const
+	{
+		std::size_t physical_addr = static_cast<const Mapper*>(this)->Mapper::GetPhysicalCHRAddress(addr);
+		return chr_rows[physical_addr >> 4 << 3 | physical_addr & 7];
+	}
 	u8 ReadNametableRAM(u16 addr);
+	/* As above, but without the virtual GetNametableMap call, for callers that know the concrete mapper type. */
+	template<typename Mapper>
+	u8 ReadNametableRAM(u16 addr)
+	{
+		int page = static_cast<const Mapper*>(this)->Mapper::GetNametableMap()[(addr & 0xF00) >> 10];
+		return nametable_ram[page][addr & 0x3FF];
+	}
 	void ReadPRGRAMFromDisk();
 	void WriteNametableRAM(u16 addr, u8 data);
 	void WritePRGRAMToDisk() const;
 
 protected:
+	void MapPRGRAM(u16 addr, std::size_t size, std::size_t offset);
+	void MapPRGROM(u16 addr, std::size_t size, std::size_t offset);
+	/* Writes to CHR RAM, and updates the decoded row of the byte (see ReadCHRRow). */
+	void WriteCHRRAM(std::size_t physical_addr, u8 data);
+
 	static void SetCHRBankSize(MapperProperties& properties, std::size_t size);
 	static void SetCHRRAMSize(MapperProperties& properties, std::size_t size);
 	static void SetPRGRAMSize(MapperProperties& properties, std::size_t size);
@@ -51,7 +97,10 @@ protected:
 	std::vector<u8> prg_rom;
 
 private:
+	void DecodeCHR();
 	int GetNametablePage(u16 addr) const;
+	template<typename Stream> void StreamMemory(Stream& stream);
 
 	std::array<std::array<u8, 0x400>, 4> nametable_ram{};
+	std::vector<u16> chr_rows; /* One per row of each 16-byte tile of 'chr'; see ReadCHRRow. */
 };
\ No newline at end of file
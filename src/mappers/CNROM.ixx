@@ -5,6 +5,7 @@ import MapperProperties;
 
 import NumericalTypes;
 import SerializationStream;
+import Snapshot;
 
 import <vector>;
 
@@ -14,6 +15,12 @@ public:
 	CNROM(std::vector<u8> chr_prg_rom, MapperProperties properties) :
 		BaseMapper(chr_prg_rom, properties) {}
 
+	void MapPRG() override
+	{
+		MapPRGROM(0x8000, 0x4000, 0);
+		MapPRGROM(0xC000, 0x4000, properties.prg_rom_size == 0x4000 ? 0 : 0x4000);
+	};
+
 	u8 ReadPRG(u16 addr) override
 	{
 		if (addr <= 0x7FFF) {
@@ -36,17 +43,33 @@ public:
 		}
 	};
 
-	u8 ReadCHR(u16 addr) override
+	std::size_t GetPhysicalCHRAddress(u16 addr) const override
 	{
 		// PPU $0000-$1FFF: 8 KiB switchable CHR ROM bank.
-		return chr[addr + 0x2000 * chr_bank];
+		return addr + 0x2000 * chr_bank;
+	};
+
+	u8 ReadCHR(u16 addr) override
+	{
+		return chr[GetPhysicalCHRAddress(addr)];
 	};
 
 	virtual void StreamState(SerializationStream& stream) override
+	{
+		StreamRegisters(stream);
+	};
+
+	virtual void StreamState(Snapshot& snapshot) override
+	{
+		StreamRegisters(snapshot);
+	};
+
+	template<typename Stream>
+	void StreamRegisters(Stream& stream)
 	{
 		BaseMapper::StreamState(stream);
 		chr_bank = stream.StreamBitfield(chr_bank);
-	};
+	}
 
 protected:
 	uint chr_bank : 2 = 0;
@@ -5,8 +5,10 @@ import MapperProperties;
 
 import NumericalTypes;
 import SerializationStream;
+import Snapshot;
 
 import <array>;
+import <utility>;
 import <vector>;
 
 export class MMC1 : public BaseMapper
@@ -18,6 +20,31 @@ public:
 	// TODO: how to distinguish between the different SxROM boards with CHR ram?
 	// TODO: implement PRG RAM banking
 
+	void MapPRG() override
+	{
+		MapPRGRAM(0x6000, 0x2000, 0);
+		/* The 16 KiB banks at $8000-$BFFF and $C000-$FFFF, respectively; see ReadPRG. */
+		auto [lower_bank, upper_bank] = [&]() -> std::pair<std::size_t, std::size_t> {
+			switch (prg_rom_bank_mode) {
+			case 0: case 1: {
+				if (properties.prg_rom_size < 0x8000) {
+					return { 0, 0 };
+				}
+				u8 aligned_bank = prg_bank & ~0x01;
+				if (aligned_bank == properties.num_prg_rom_banks - 1) {
+					return { 0, 0 };
+				}
+				return { aligned_bank, aligned_bank + 1 };
+			}
+			case 2: return { 0, std::size_t(prg_bank) };
+			case 3: return { std::size_t(prg_bank), properties.num_prg_rom_banks - 1 };
+			default: std::unreachable();
+			}
+		}();
+		MapPRGROM(0x8000, 0x4000, lower_bank * 0x4000);
+		MapPRGROM(0xC000, 0x4000, upper_bank * 0x4000);
+	};
+
 	u8 ReadPRG(u16 addr) override
 	{
 		if (addr <= 0x5FFF) {
@@ -113,10 +140,11 @@ public:
 					times_written_to_control_register = 0;
 				}
 			}
+			MapPRG();
 		}
 	};
 
-	u8 ReadCHR(u16 addr) override
+	std::size_t GetPhysicalCHRAddress(u16 addr) const override
 	{
 		// 8 KiB mode; $0000-$1FFF is mapped to a single 8 KiB bank (bit 0 of the bank number is ignored).
 		// Effectively, this is mapping $0000-$0FFF to 'chr_bank_0 & ~0x01', and $1000-$1FFF to '(chr_bank_0 & ~0x01) + 1'
@@ -126,36 +154,26 @@ public:
 			if (aligned_bank == properties.num_chr_banks - 1) {
 				addr &= 0xFFF;
 			}
-			return chr[addr + 0x1000 * aligned_bank];
+			return addr + 0x1000 * aligned_bank;
 		}
 		// 4 KiB mode; $0000-$0FFF and $1000-$1FFF are mapped to separate 4 KiB banks.
 		if (addr <= 0x0FFF) {
-			return chr[addr + 0x1000 * chr_bank_0];
+			return addr + 0x1000 * chr_bank_0;
 		}
 		else {
-			return chr[addr - 0x1000 + 0x1000 * chr_bank_1];
+			return addr - 0x1000 + 0x1000 * chr_bank_1;
 		}
 	};
 
+	u8 ReadCHR(u16 addr) override
+	{
+		return chr[GetPhysicalCHRAddress(addr)];
+	};
+
 	void WriteCHR(u16 addr, u8 data) override
 	{
-		if (!properties.has_chr_ram) {
-			return;
-		}
-		if (chr_bank_mode == 0) {
-			u8 aligned_bank = chr_bank_0 & ~0x01;
-			if (aligned_bank == properties.num_chr_banks - 1) {
-				addr &= 0xFFF;
-			}
-			chr[addr + 0x1000 * aligned_bank] = data;
-		}
-		else {
-			if (addr <= 0x0FFF) {
-				chr[addr + 0x1000 * chr_bank_0] = data;
-			}
-			else {
-				chr[addr - 0x1000 + 0x1000 * chr_bank_1] = data;
-			}
+		if (properties.has_chr_ram) {
+			WriteCHRRAM(GetPhysicalCHRAddress(addr), data);
 		}
 	};
 
@@ -171,6 +189,17 @@ public:
 	};
 
 	virtual void StreamState(SerializationStream& stream) override
+	{
+		StreamRegisters(stream);
+	};
+
+	virtual void StreamState(Snapshot& snapshot) override
+	{
+		StreamRegisters(snapshot);
+	};
+
+	template<typename Stream>
+	void StreamRegisters(Stream& stream)
 	{
 		BaseMapper::StreamState(stream);
 		stream.StreamPrimitive(prg_ram_enabled);
@@ -183,7 +212,7 @@ public:
 		prg_rom_bank_mode = stream.StreamBitfield(prg_rom_bank_mode);
 		shift_reg = stream.StreamBitfield(shift_reg);
 		stream.StreamPrimitive(times_written_to_control_register);
-	};
+	}
 
 protected:
 	// TODO: what are the default values of these?
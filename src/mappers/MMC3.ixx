@@ -6,6 +6,7 @@ import MapperProperties;
 
 import NumericalTypes;
 import SerializationStream;
+import Snapshot;
 
 import <array>;
 import <vector>;
@@ -16,6 +17,16 @@ public:
 	MMC3(std::vector<u8> chr_prg_rom, MapperProperties properties) :
 		BaseMapper(chr_prg_rom, MutateProperties(properties)) {}
 
+	void MapPRG() override
+	{
+		const std::size_t second_last_bank = properties.num_prg_rom_banks - 2;
+		MapPRGRAM(0x6000, 0x2000, 0);
+		MapPRGROM(0x8000, 0x2000, 0x2000 * (prg_rom_bank_mode == 0 ? rom_bank[6] : second_last_bank));
+		MapPRGROM(0xA000, 0x2000, 0x2000 * rom_bank[7]);
+		MapPRGROM(0xC000, 0x2000, 0x2000 * (prg_rom_bank_mode == 1 ? rom_bank[6] : second_last_bank));
+		MapPRGROM(0xE000, 0x2000, 0x2000 * (properties.num_prg_rom_banks - 1));
+	};
+
 	u8 ReadPRG(u16 addr) override
 	{
 		switch (addr >> 12) {
@@ -81,6 +92,7 @@ public:
 				prg_rom_bank_mode = data & 0x40;
 				chr_a12_inversion = data & 0x80;
 			}
+			MapPRG();
 			break;
 
 			// CPU $A000-$BFFF; mirroring (even), PRG RAM protect (odd)
@@ -119,19 +131,85 @@ public:
 		}
 	};
 
+	std::size_t GetPhysicalCHRAddress(u16 addr) const override
+	{
+		/* CHR map mode -> $8000.D7 = 0  $8000.D7 = 1
+		   PPU Bank	         Value of MMC3 register
+		   $0000-$03FF	        R0          R2
+		   $0400-$07FF	        R0          R3
+		   $0800-$0BFF	        R1          R4
+		   $0C00-$0FFF	        R1          R5
+		   $1000-$13FF	        R2          R0
+		   $1400-$17FF	        R3          R0
+		   $1800-$1BFF	        R4          R1
+		   $1C00-$1FFF	        R5          R1
+
+		   CHR inversion:
+		   0: two 2 KB banks at $0000-$0FFF, four 1 KB banks at $1000-$1FFF;
+		   1: two 2 KB banks at $1000-$1FFF, four 1 KB banks at $0000-$0FFF.
+		*/
+		switch (addr >> 8 & 0x1F) {
+			// PPU $0000-$07FF (or $1000-$17FF): 2 KiB switchable CHR bank
+		case 0x00: case 0x01: case 0x02: case 0x03:
+			return chr_a12_inversion
+				? addr + 0x400 * rom_bank[2]
+				: addr + 0x400 * rom_bank[0];
+
+		case 0x04: case 0x05: case 0x06: case 0x07:
+			return chr_a12_inversion
+				? addr + 0x400 * rom_bank[3] - 0x400
+				: addr + 0x400 * rom_bank[0];
+
+			// PPU $0800-$0FFF (or $1800-$1FFF): 2 KiB switchable CHR bank
+		case 0x08: case 0x09: case 0x0A: case 0x0B:
+			return chr_a12_inversion
+				? addr + 0x400 * rom_bank[4] - 0x800
+				: addr + 0x400 * rom_bank[1] - 0x800;
+
+		case 0x0C: case 0x0D: case 0x0E: case 0x0F:
+			return chr_a12_inversion
+				? addr + 0x400 * rom_bank[5] - 0xC00
+				: addr + 0x400 * rom_bank[1] - 0x800;
+
+			// PPU $1000-$13FF (or $0000-$03FF): 1 KiB switchable CHR bank
+		case 0x10: case 0x11: case 0x12: case 0x13:
+			return chr_a12_inversion
+				? addr + 0x400 * rom_bank[0] - 0x1000
+				: addr + 0x400 * rom_bank[2] - 0x1000;
+
+			// PPU $1400-$17FF (or $0400-$07FF): 1 KiB switchable CHR bank
+		case 0x14: case 0x15: case 0x16: case 0x17:
+			return chr_a12_inversion
+				? addr + 0x400 * rom_bank[0] - 0x1000
+				: addr + 0x400 * rom_bank[3] - 0x1400;
+
+			// PPU $1800-$1BFF (or $0800-$0BFF): 1 KiB switchable CHR bank
+		case 0x18: case 0x19: case 0x1A: case 0x1B:
+			return chr_a12_inversion
+				? addr + 0x400 * rom_bank[1] - 0x1800
+				: addr + 0x400 * rom_bank[4] - 0x1800;
+
+			// PPU $1C00-$1FFF (or $0C00-$0FFF): 1 KiB switchable CHR bank
+		case 0x1C: case 0x1D: case 0x1E: case 0x1F:
+			return chr_a12_inversion
+				? addr + 0x400 * rom_bank[1] - 0x1800
+				: addr + 0x400 * rom_bank[5] - 0x1C00;
+
+		default: /* Should never happen */
+			std::unreachable();
+		}
+	}
+
 	u8 ReadCHR(u16 addr) override
 	{
-		auto physical_addr = GetPhysicalCHRAddress(addr);
-		return chr[physical_addr];
+		return chr[GetPhysicalCHRAddress(addr)];
 	}
 
 	void WriteCHR(u16 addr, u8 data) override
 	{
-		if (!properties.has_chr_ram) {
-			return;
+		if (properties.has_chr_ram) {
+			WriteCHRRAM(GetPhysicalCHRAddress(addr), data);
 		}
-		auto physical_addr = GetPhysicalCHRAddress(addr);
-		chr[physical_addr] = data;
 	}
 
 	const std::array<int, 4>& GetNametableMap() const override
@@ -163,7 +241,24 @@ public:
 		}
 	}
 
+	virtual uint GetCpuCyclesUntilNextEvent() const override
+	{
+		/* The scanline counter is clocked by the PPU fetches, so the timing of an enabled IRQ is not predicted. */
+		return irq_enabled ? 0 : BaseMapper::GetCpuCyclesUntilNextEvent();
+	}
+
 	virtual void StreamState(SerializationStream& stream) override
+	{
+		StreamRegisters(stream);
+	};
+
+	virtual void StreamState(Snapshot& snapshot) override
+	{
+		StreamRegisters(snapshot);
+	};
+
+	template<typename Stream>
+	void StreamRegisters(Stream& stream)
 	{
 		BaseMapper::StreamState(stream);
 
@@ -182,7 +277,7 @@ public:
 		stream.StreamPrimitive(prg_ram_open_bus);
 
 		stream.StreamArray(rom_bank);
-	};
+	}
 
 protected:
 	bool nametable_mirroring = 0;
@@ -217,75 +312,6 @@ protected:
 	u8 prg_ram_open_bus = 0;
 	std::array<u8, 8> rom_bank{}; // 0..5 : CHR; 6, 7 : PRG
 
-	std::size_t GetPhysicalCHRAddress(const u16 addr) const
-	{
-		/* CHR map mode -> $8000.D7 = 0  $8000.D7 = 1
-		   PPU Bank	         Value of MMC3 register
-		   $0000-$03FF	        R0          R2
-		   $0400-$07FF	        R0          R3
-		   $0800-$0BFF	        R1          R4
-		   $0C00-$0FFF	        R1          R5
-		   $1000-$13FF	        R2          R0
-		   $1400-$17FF	        R3          R0
-		   $1800-$1BFF	        R4          R1
-		   $1C00-$1FFF	        R5          R1
-
-		   CHR inversion:
-		   0: two 2 KB banks at $0000-$0FFF, four 1 KB banks at $1000-$1FFF;
-		   1: two 2 KB banks at $1000-$1FFF, four 1 KB banks at $0000-$0FFF.
-		*/
-		switch (addr >> 8 & 0x1F) {
-			// PPU $0000-$07FF (or $1000-$17FF): 2 KiB switchable CHR bank
-		case 0x00: case 0x01: case 0x02: case 0x03:
-			return chr_a12_inversion
-				? addr + 0x400 * rom_bank[2]
-				: addr + 0x400 * rom_bank[0];
-
-		case 0x04: case 0x05: case 0x06: case 0x07:
-			return chr_a12_inversion
-				? addr + 0x400 * rom_bank[3] - 0x400
-				: addr + 0x400 * rom_bank[0];
-
-			// PPU $0800-$0FFF (or $1800-$1FFF): 2 KiB switchable CHR bank
-		case 0x08: case 0x09: case 0x0A: case 0x0B:
-			return chr_a12_inversion
-				? addr + 0x400 * rom_bank[4] - 0x800
-				: addr + 0x400 * rom_bank[1] - 0x800;
-
-		case 0x0C: case 0x0D: case 0x0E: case 0x0F:
-			return chr_a12_inversion
-				? addr + 0x400 * rom_bank[5] - 0xC00
-				: addr + 0x400 * rom_bank[1] - 0x800;
-
-			// PPU $1000-$13FF (or $0000-$03FF): 1 KiB switchable CHR bank
-		case 0x10: case 0x11: case 0x12: case 0x13:
-			return chr_a12_inversion
-				? addr + 0x400 * rom_bank[0] - 0x1000
-				: addr + 0x400 * rom_bank[2] - 0x1000;
-
-			// PPU $1400-$17FF (or $0400-$07FF): 1 KiB switchable CHR bank
-		case 0x14: case 0x15: case 0x16: case 0x17:
-			return chr_a12_inversion
-				? addr + 0x400 * rom_bank[0] - 0x1000
-				: addr + 0x400 * rom_bank[3] - 0x1400;
-
-			// PPU $1800-$1BFF (or $0800-$0BFF): 1 KiB switchable CHR bank
-		case 0x18: case 0x19: case 0x1A: case 0x1B:
-			return chr_a12_inversion
-				? addr + 0x400 * rom_bank[1] - 0x1800
-				: addr + 0x400 * rom_bank[4] - 0x1800;
-
-			// PPU $1C00-$1FFF (or $0C00-$0FFF): 1 KiB switchable CHR bank
-		case 0x1C: case 0x1D: case 0x1E: case 0x1F:
-			return chr_a12_inversion
-				? addr + 0x400 * rom_bank[1] - 0x1800
-				: addr + 0x400 * rom_bank[5] - 0x1C00;
-
-		default: /* Should never happen */
-			std::unreachable();
-		}
-	}
-
 private:
 	static MapperProperties MutateProperties(MapperProperties properties)
 	{
@@ -18,6 +18,7 @@ public:
 	{
 		if (addr >= 0x8000) {
 			prg_bank = (data >> 2) % properties.num_prg_rom_banks;
+			MapPRG();
 		}
 	};
 };
\ No newline at end of file
@@ -14,6 +14,12 @@ public:
 	Mapper180(std::vector<u8> chr_prg_rom, MapperProperties properties) :
 		UxROM(chr_prg_rom, properties) {}
 
+	void MapPRG() override
+	{
+		MapPRGROM(0x8000, 0x4000, prg_bank * 0x4000);
+		MapPRGROM(0xC000, 0x4000, 0);
+	};
+
 	u8 ReadPRG(u16 addr) override
 	{
 		if (addr <= 0x7FFF) {
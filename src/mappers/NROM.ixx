@@ -14,6 +14,13 @@ public:
 	NROM(std::vector<u8> chr_prg_rom, MapperProperties properties) :
 		BaseMapper(chr_prg_rom, MutateProperties(properties)) {}
 
+	void MapPRG() override
+	{
+		MapPRGRAM(0x6000, 0x2000, 0);
+		MapPRGROM(0x8000, 0x4000, 0);
+		MapPRGROM(0xC000, 0x4000, properties.prg_rom_size == 0x4000 ? 0 : 0x4000);
+	};
+
 	u8 ReadPRG(u16 addr) override
 	{
 		if (addr <= 0x5FFF) {
@@ -41,16 +48,21 @@ public:
 		}
 	};
 
-	u8 ReadCHR(u16 addr) override
+	std::size_t GetPhysicalCHRAddress(u16 addr) const override
 	{
 		// PPU $0000-$1FFF: 8 KiB (not bank switched)
-		return chr[addr];
+		return addr;
+	};
+
+	u8 ReadCHR(u16 addr) override
+	{
+		return chr[GetPhysicalCHRAddress(addr)];
 	};
 
 	void WriteCHR(u16 addr, u8 data) override
 	{
 		if (properties.has_chr_ram) {
-			chr[addr] = data;
+			WriteCHRRAM(GetPhysicalCHRAddress(addr), data);
 		}
 	};
 
@@ -5,6 +5,7 @@ import MapperProperties;
 
 import NumericalTypes;
 import SerializationStream;
+import Snapshot;
 
 import <vector>;
 
@@ -14,6 +15,12 @@ public:
 	UxROM(std::vector<u8> chr_prg_rom, MapperProperties properties) :
 		BaseMapper(chr_prg_rom, MutateProperties(properties)) {}
 
+	void MapPRG() override
+	{
+		MapPRGROM(0x8000, 0x4000, prg_bank * 0x4000);
+		MapPRGROM(0xC000, 0x4000, (properties.num_prg_rom_banks - 1) * 0x4000);
+	};
+
 	u8 ReadPRG(u16 addr) override
 	{
 		if (addr <= 0x7FFF) {
@@ -33,27 +40,44 @@ public:
 	{
 		if (addr >= 0x8000) {
 			prg_bank = data % properties.num_prg_rom_banks;
+			MapPRG();
 		}
 	};
 
-	u8 ReadCHR(u16 addr) override
+	std::size_t GetPhysicalCHRAddress(u16 addr) const override
 	{
 		// PPU $0000-$1FFF: 8 KiB (not bank switched)
-		return chr[addr];
+		return addr;
+	};
+
+	u8 ReadCHR(u16 addr) override
+	{
+		return chr[GetPhysicalCHRAddress(addr)];
 	};
 
 	void WriteCHR(u16 addr, u8 data) override
 	{
 		if (properties.has_chr_ram) {
-			chr[addr] = data;
+			WriteCHRRAM(GetPhysicalCHRAddress(addr), data);
 		}
 	};
 
 	virtual void StreamState(SerializationStream& stream) override
+	{
+		StreamRegisters(stream);
+	};
+
+	virtual void StreamState(Snapshot& snapshot) override
+	{
+		StreamRegisters(snapshot);
+	};
+
+	template<typename Stream>
+	void StreamRegisters(Stream& stream)
 	{
 		BaseMapper::StreamState(stream);
 		stream.StreamPrimitive(prg_bank);
-	};
+	}
 
 protected:
 	u8 prg_bank = 0;
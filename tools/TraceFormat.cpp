@@ -0,0 +1,30 @@
+import TraceFile;
+
+import <cstdlib>;
+import <fstream>;
+import <iostream>;
+import <string>;
+
+/* Converts a binary execution trace, recorded with Debug::StartTraceRecording, to text.
+   Usage: NESTraceFormat <trace path> [output path] */
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		std::cerr << "Usage: NESTraceFormat <trace path> [output path]\n";
+		return EXIT_FAILURE;
+	}
+	bool success;
+	if (argc >= 3) {
+		std::ofstream out{ argv[2], std::ofstream::out | std::ofstream::binary };
+		success = out && TraceFile::Format(argv[1], out);
+	}
+	else {
+		success = TraceFile::Format(argv[1], std::cout);
+	}
+	if (!success) {
+		std::cerr << "Failed to format the trace at " << argv[1] << '\n';
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
\ No newline at end of file